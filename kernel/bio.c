@@ -12,6 +12,9 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Blocks are read and written by the driver that bdevsw[]
+// has for the device: the virtio disk or the ramdisk.
 
 
 #include "types.h"
@@ -26,24 +29,33 @@
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  uchar data[NBUF][MAXBSIZE];  // buf[i].data
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  uint bsize[NDEV];  // size of blocks read from each device
 } bcache;
 
+struct bdevsw bdevsw[NDEV];
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NDEV; i++)
+    bcache.bsize[i] = BSIZE;
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+    b->data = bcache.data[b - bcache.buf];
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
@@ -96,19 +108,78 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    b->size = bcache.bsize[dev];
+    bdevsw[dev].rw(b, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the block, like bread(), but don't
+// read it if the cache doesn't hold it: the buf then has valid
+// == 0, and keeps anyone else from reading the block into the
+// cache until bdirect() has moved it.
+struct buf*
+bpeek(uint dev, uint blockno)
+{
+  return bget(dev, blockno);
+}
+
+// Read or write b's block straight from or to physical address
+// pa, without the cache, for O_DIRECT, and release b. b must be
+// from bpeek() and not valid; it stays that way, so the next
+// bread() reads what's on disk.
+void
+bdirect(struct buf *b, uint64 pa, int write)
+{
+  uchar *data = b->data;
+
+  if(!holdingsleep(&b->lock) || b->valid)
+    panic("bdirect");
+  b->size = bcache.bsize[b->dev];
+  b->data = (uchar*)pa;
+  bdevsw[b->dev].rw(b, write);
+  b->data = data;
+  bdrop(b);
+}
+
+// Switch dev to size-byte blocks, once fsinit() has found the
+// block size in the super block. Cached blocks have the old size,
+// so forget their contents; none may be in use.
+void
+bsetsize(uint dev, uint size)
+{
+  struct buf *b;
+
+  if(dev >= NDEV || size > MAXBSIZE || size % 512 != 0)
+    panic("bsetsize");
+
+  acquire(&bcache.lock);
+  bcache.bsize[dev] = size;
+  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+    if(b->dev != dev)
+      continue;
+    if(b->refcnt != 0)
+      panic("bsetsize: busy");
+    b->valid = 0;
+  }
+  release(&bcache.lock);
+}
+
+// Is there a block device dev?
+int
+bdev(uint dev)
+{
+  return dev < NDEV && bdevsw[dev].rw != 0;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bdevsw[b->dev].rw(b, 1);
 }
 
 // Release a locked buffer.
@@ -136,6 +207,30 @@ brelse(struct buf *b)
   release(&bcache.lock);
 }
 
+// Release a locked buffer that isn't likely to be used again,
+// leaving it at the least-recently-used end of the list, so that
+// it is the next to be recycled.
+void
+bdrop(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bdrop");
+
+  releasesleep(&b->lock);
+
+  acquire(&bcache.lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    b->prev = bcache.head.prev;
+    b->next = &bcache.head;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+  release(&bcache.lock);
+}
+
 void
 bpin(struct buf *b) {
   acquire(&bcache.lock);
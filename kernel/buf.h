@@ -3,10 +3,18 @@ struct buf {
   int disk;    // does disk "own" buf?
   uint dev;
   uint blockno;
+  uint size;   // block size in bytes
   struct sleeplock lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // size bytes: in bcache, or see bdirect()
 };
 
+// map block device number to driver; see bio.c.
+struct bdevsw {
+  void (*rw)(struct buf*, int write);
+};
+
+extern struct bdevsw bdevsw[];
+
@@ -1,12 +1,15 @@
 struct buf;
 struct context;
 struct file;
+struct fsops;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct statfs;
 struct superblock;
 
 // bio.c
@@ -16,6 +19,11 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bsetsize(uint, uint);
+struct buf*     bpeek(uint, uint);
+void            bdirect(struct buf*, uint64, int);
+void            bdrop(struct buf*);
+int             bdev(uint);
 
 // console.c
 void            consoleinit(void);
@@ -32,15 +40,33 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
+int             filesync(struct file*, int);
 int             filewrite(struct file*, uint64, int n);
+int             filepread(struct file*, uint64, int n, uint off);
+int             filepwrite(struct file*, uint64, int n, uint off);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filesend(struct file*, struct file*, int);
+int             fileprealloc(struct file*, uint, uint);
 
 // fs.c
-void            fsinit(int);
+int             fsinit(int);
+void            fsregister(uint, struct fsops*);
+uint            fsbsize(uint);
+void            fsstat(uint, struct statfs*);
+int             fsreadblock(uint, uint, uint64);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
+struct buf*     ibread(struct inode*, uint);
 struct inode*   idup(struct inode*);
+struct inode*   iget(uint, uint);
 void            iinit();
+void            ireclaim(int);
+void            flusher(void*);
+void            flusherwake(void);
+int             rwdirect(struct inode*, int, uint64, uint, uint);
+int             iprealloc(struct inode*, uint, uint);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -53,28 +79,41 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             mount(char*, uint);
+int             umount(char*);
+int             ismounted(struct inode*);
+
+// tmpfs.c
+void            tmpfsinit(void);
 
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+void            ramdiskload(void);
+void            ramdiskrw(struct buf*, int);
 
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+int             kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+uint            log_tid(uint);
+void            log_force(uint, uint);
+int             log_tick(void);
+void            loginit(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipespace(struct pipe*);
+int             pipeput(struct pipe*, char*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,21 +124,31 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+int             threaded(struct proc*);
+uint64          growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             kthread_create(void (*)(void*), void*, char*);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            schedtick(void);
 void            setproc(struct proc*);
+int             setpriority(int, int);
+int             setaffinity(int, uint);
+int             getaffinity(int);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
+void            wakeproc(struct proc*, void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -139,10 +188,28 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+uint            timernext(void);
+void            timersleep(uint);
+void            timersleephr(uint64);
+void            timertick(void);
+void            timerset(uint64, void*, struct spinlock*);
+int             timerfired(void);
+void            timercancel(void);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int, uint64);
+int             futexwake(uint64, int);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
+uint64          nexttick(void);
+uint64          mtime(void);
+void            timerarm(uint64);
+void            tickupdate(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
@@ -168,6 +235,7 @@ void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
+uint64          walkuser(pagetable_t, uint64, uint, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -21,6 +21,10 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  // other threads are using the old image.
+  if(threaded(p))
+    return -1;
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -12,6 +12,10 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "uio.h"
+#include "buf.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct devsw devsw[NDEV];
 struct {
@@ -101,6 +105,41 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Wait until f's inode is on disk: all of it, or if datasync,
+// just its contents (its size and blocks included).
+int
+filesync(struct file *f, int datasync)
+{
+  uint tid;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  tid = datasync ? f->ip->datatid : f->ip->synctid;
+  iunlock(f->ip);
+  log_force(f->ip->dev, tid);
+  return 0;
+}
+
+// Read or write n bytes of f's inode at off, to or from user
+// address addr, through the buffer cache unless f is O_DIRECT.
+// Caller must hold f->ip->lock, and be in a transaction to write.
+static int
+readinode(struct file *f, uint64 addr, uint off, int n)
+{
+  if(f->direct)
+    return rwdirect(f->ip, 0, addr, off, n);
+  return readi(f->ip, 1, addr, off, n);
+}
+
+static int
+writeinode1(struct file *f, uint64 addr, uint off, int n)
+{
+  if(f->direct)
+    return rwdirect(f->ip, 1, addr, off, n);
+  return writei(f->ip, 1, addr, off, n);
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -119,7 +158,7 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if((r = readinode(f, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
   } else {
@@ -129,12 +168,109 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Read from inode-backed file f at offset off.
+// Neither uses nor updates f->off, so several processes can
+// read the same open file concurrently.
+// addr is a user virtual address.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+
+  ilock(f->ip);
+  r = readinode(f, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Read into the iovcnt buffers of iov in order.
+// An inode is locked once for the whole vector, so the data
+// is a contiguous range of the file. A pipe or device only
+// fills the first non-empty buffer, since further reads
+// could block after some data has already been returned.
+int
+filereadv(struct file *f, struct iovec *iov, int iovcnt)
+{
+  int i, r, tot = 0;
+
+  if(f->readable == 0)
+    return -1;
+
+  if(f->type == FD_INODE){
+    ilock(f->ip);
+    for(i = 0; i < iovcnt; i++){
+      r = readinode(f, (uint64)iov[i].iov_base, f->off, iov[i].iov_len);
+      f->off += r;
+      tot += r;
+      if(r != iov[i].iov_len)
+        break;
+    }
+    iunlock(f->ip);
+    return tot;
+  }
+
+  for(i = 0; i < iovcnt; i++){
+    if(iov[i].iov_len > 0)
+      return fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len);
+  }
+  return 0;
+}
+
+// Largest write to ip that fits in one log transaction:
+// the data blocks plus i-node, indirect block, allocation
+// blocks, and 2 blocks of slop for non-aligned writes.
+// File systems without blocks don't log, so have no limit.
+static int
+maxwrite(struct inode *ip)
+{
+  uint bsize = fsbsize(ip->dev);
+
+  if(bsize == 0)
+    return 0x7fffffff;
+  return ((MAXOPBLOCKS-1-1-2) / 2) * bsize;
+}
+
+// Write n bytes from user address addr to f's inode at *poff,
+// a few blocks at a time to avoid exceeding the maximum log
+// transaction size, and advance *poff.
+// Returns n, or -1 on error.
+static int
+writeinode(struct file *f, uint64 addr, int n, uint *poff)
+{
+  struct inode *ip = f->ip;
+  int r = 0, i = 0, max = maxwrite(ip);
+
+  ireclaim(0);  // free deleted files' blocks before using more
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
+    ilock(ip);
+    if ((r = writeinode1(f, addr + i, *poff, n1)) > 0)
+      *poff += r;
+    iunlock(ip);
+    end_op();
+
+    if(r < 0)
+      break;
+    if(r != n1)
+      panic("short filewrite");
+    i += r;
+  }
+  return (i == n ? n : -1);
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
@@ -146,37 +282,193 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+    ret = writeinode(f, addr, n, &f->off);
+  } else {
+    panic("filewrite");
+  }
+
+  return ret;
+}
+
+// Write to inode-backed file f at offset off, without
+// using or updating f->off.
+// addr is a user virtual address.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+
+  return writeinode(f, addr, n, &off);
+}
+
+// Write the iovcnt buffers of iov in order, stopping at the
+// first that can't be written in full.
+// If the whole vector fits in one log transaction, write it
+// to an inode under a single begin_op()/end_op().
+// Returns the number of bytes written, or -1 if none were.
+int
+filewritev(struct file *f, struct iovec *iov, int iovcnt)
+{
+  int i, r = 0, tot = 0;
+
+  if(f->writable == 0)
+    return -1;
+
+  for(i = 0; i < iovcnt; i++)
+    tot += iov[i].iov_len;
+
+  if(f->type == FD_INODE && tot <= maxwrite(f->ip)){
+    tot = 0;
+    ireclaim(0);  // free deleted files' blocks before using more
+    begin_op();
+    ilock(f->ip);
+    for(i = 0; i < iovcnt; i++){
+      r = writeinode1(f, (uint64)iov[i].iov_base, f->off, iov[i].iov_len);
+      if(r > 0){
         f->off += r;
-      iunlock(f->ip);
-      end_op();
+        tot += r;
+      }
+      if(r != iov[i].iov_len)
+        break;
+    }
+    iunlock(f->ip);
+    end_op();
+    return (tot == 0 && r < 0) ? -1 : tot;
+  }
+
+  tot = 0;
+  for(i = 0; i < iovcnt; i++){
+    r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len);
+    if(r > 0)
+      tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  return (tot == 0 && r < 0) ? -1 : tot;
+}
+
+// Lock two distinct inodes, in address order so that two
+// filesend()s between the same files can't deadlock. Both must
+// be plain files: create(), unlink() and link() lock a directory
+// before its entries, which address order could contradict.
+static void
+ilock2(struct inode *a, struct inode *b)
+{
+  if(a > b){
+    ilock(b);
+    ilock(a);
+  } else {
+    ilock(a);
+    ilock(b);
+  }
+}
 
+// Move up to n bytes from plain file in to file out,
+// which may be a pipe or another inode, without copying through
+// user space: the data is taken straight from in's buffer cache
+// blocks, or from the inode for a small file whose data is kept
+// there. Advances both files' offsets.
+// Returns the number of bytes moved, or -1 if nothing could be.
+int
+filesend(struct file *out, struct file *in, int n)
+{
+  struct buf *bp;
+  struct inode *ip = in->ip;
+  char *src;
+  int r = 0, m, boff, space, tot = 0, tot1, max;
+  uint bsize;
+
+  if(in->readable == 0 || out->writable == 0 || in->type != FD_INODE)
+    return -1;
+  // the data must be in the buffer cache.
+  if((bsize = fsbsize(ip->dev)) == 0)
+    return -1;
+  if(out->type != FD_PIPE && out->type != FD_INODE)
+    return -1;
+  if(out->type == FD_INODE && out->ip == ip)
+    return -1;
+  // an open file's inode can't change type, so these need no lock.
+  if(ip->type != T_FILE || (out->type == FD_INODE && out->ip->type != T_FILE))
+    return -1;
+
+  if(out->type == FD_PIPE){
+    while(tot < n){
+      // hold the block only while copying it into the pipe; waiting
+      // for the reader with it locked could deadlock if the reader
+      // wants the same block.
+      if((space = pipespace(out->pipe)) < 0){
+        r = -1;
+        break;
+      }
+      ilock(ip);
+      if(in->off >= ip->size){
+        iunlock(ip);
+        break;
+      }
+      boff = in->off % bsize;
+      m = min(min(n - tot, bsize - boff), min(ip->size - in->off, space));
+      bp = ibread(ip, in->off);
+      src = bp ? (char*)bp->data + boff : ip->data + in->off;
+      if((r = pipeput(out->pipe, src, m)) > 0){
+        in->off += r;
+        tot += r;
+      }
+      if(bp)
+        brelse(bp);
+      iunlock(ip);
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+    return (tot == 0 && r < 0) ? -1 : tot;
   }
 
-  return ret;
+  max = maxwrite(out->ip);
+  while(tot < n){
+    // a transaction's worth of blocks at a time, as in writeinode().
+    begin_op();
+    ilock2(ip, out->ip);
+    for(tot1 = 0; tot1 < max && tot < n && in->off < ip->size; tot1 += r){
+      boff = in->off % bsize;
+      m = min(min(n - tot, bsize - boff), min(ip->size - in->off, max - tot1));
+      bp = ibread(ip, in->off);
+      src = bp ? (char*)bp->data + boff : ip->data + in->off;
+      r = writei(out->ip, 0, (uint64)src, out->off, m);
+      if(bp)
+        brelse(bp);
+      if(r <= 0)
+        break;
+      in->off += r;
+      out->off += r;
+      tot += r;
+    }
+    iunlock(out->ip);
+    iunlock(ip);
+    end_op();
+    if(r < 0 || tot1 == 0)
+      break;
+  }
+  return (tot == 0 && r < 0) ? -1 : tot;
 }
 
+// Allocate blocks for bytes [off, off+len) of inode-backed
+// file f without changing its size, so that writes there
+// needn't allocate; see disk_prealloc().
+int
+fileprealloc(struct file *f, uint off, uint len)
+{
+  int r;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  do {
+    begin_op();
+    ilock(f->ip);
+    r = iprealloc(f->ip, off, len);
+    iunlock(f->ip);
+    end_op();
+  } while(r == 1);
+  return r;
+}
@@ -6,6 +6,7 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  char direct;       // FD_INODE opened O_DIRECT; see rwdirect()
   short major;       // FD_DEVICE
 };
 
@@ -27,6 +28,10 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  char data[NINLINE];
+
+  uint synctid;       // last transaction to update the inode
+  uint datatid;       // last transaction to change its contents
 };
 
 // map major device number to device functions.
@@ -37,4 +42,24 @@ struct devsw {
 
 extern struct devsw devsw[];
 
+// map file system device number to file system functions;
+// see fs.c.
+struct statfs;
+struct fsops {
+  struct inode* (*ialloc)(uint, short, uint);
+  void (*iread)(struct inode*);     // fill in ip from storage
+  void (*iupdate)(struct inode*);
+  void (*itrunc)(struct inode*);
+  void (*ifree)(struct inode*);     // free unlinked, unused ip
+  int (*readi)(struct inode*, int, uint64, uint, uint);
+  int (*writei)(struct inode*, int, uint64, uint, uint);
+  struct buf* (*ibread)(struct inode*, uint);  // 0 if no blocks
+  uint (*bsize)(uint);
+  void (*statfs)(uint, struct statfs*);  // fill in all but dev, frag
+  int (*prealloc)(struct inode*, uint, uint);  // 0 if no blocks
+};
+
+extern struct fsops diskfsops;
+extern struct fsops tmpfsops;
+
 #define CONSOLE 1
@@ -22,28 +22,39 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+// one superblock per disk device, once fsinit() has read it.
+struct superblock sb[NDEV];
 
 // Read the super block.
+// Called before bsetsize(), so blocks are still BSIZE bytes.
 static void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / BSIZE);
+  memmove(sb, bp->data + SBOFF % BSIZE, sizeof(*sb));
   brelse(bp);
 }
 
-// Init fs
-void
+// Init the file system on block device dev.
+// Returns -1 if dev does not hold one.
+int
 fsinit(int dev) {
-  readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
-    panic("invalid file system");
-  initlog(dev, &sb);
+  struct superblock *sp;
+
+  if(dev < 0 || dev >= NDEV || !bdev(dev))
+    return -1;
+  sp = &sb[dev];
+  readsb(dev, sp);
+  if(sp->magic != FSMAGIC)
+    return -1;
+  if(sp->bsize < BSIZE || sp->bsize > MAXBSIZE || sp->bsize % BSIZE != 0)
+    return -1;
+  bsetsize(dev, sp->bsize);
+  initlog(dev, sp);
+  fsregister(dev, &diskfsops);
+  return 0;
 }
 
 // Zero a block.
@@ -53,7 +64,7 @@ bzero(int dev, int bno)
   struct buf *bp;
 
   bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  memset(bp->data, 0, sb[dev].bsize);
   log_write(bp);
   brelse(bp);
 }
@@ -68,9 +79,9 @@ balloc(uint dev)
   struct buf *bp;
 
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  for(b = 0; b < sb[dev].size; b += BPB(sb[dev])){
+    bp = bread(dev, BBLOCK(b, sb[dev]));
+    for(bi = 0; bi < BPB(sb[dev]) && b + bi < sb[dev].size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
@@ -85,21 +96,140 @@ balloc(uint dev)
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Find a run of free blocks on dev: n long if there is one,
+// else the longest there is. Sets *len to its length, 0 if
+// the disk is full, and returns its first block.
+static uint
+bfindrun(uint dev, uint n, uint *len)
+{
+  struct buf *bp;
+  uint b, bi, start, run, best;
+
+  *len = best = start = run = 0;
+  for(b = 0; b < sb[dev].size; b += BPB(sb[dev])){
+    bp = bread(dev, BBLOCK(b, sb[dev]));
+    for(bi = 0; bi < BPB(sb[dev]) && b + bi < sb[dev].size; bi++){
+      if(bp->data[bi/8] & (1 << (bi % 8))){
+        run = 0;
+        continue;
+      }
+      if(run++ == 0)
+        start = b + bi;
+      if(run > *len){
+        *len = run;
+        best = start;
+      }
+      if(run == n){
+        brelse(bp);
+        return best;
+      }
+    }
+    brelse(bp);
+  }
+  return best;
+}
+
+// Mark the len free blocks from start allocated, without
+// zeroing them.
 static void
-bfree(int dev, uint b)
+ballocrun(uint dev, uint start, uint len)
 {
   struct buf *bp;
-  int bi, m;
+  uint b, bi;
 
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  bp = 0;
+  for(b = start; b < start + len; b++){
+    if(bp == 0 || bp->blockno != BBLOCK(b, sb[dev])){
+      if(bp){
+        log_write(bp);
+        brelse(bp);
+      }
+      bp = bread(dev, BBLOCK(b, sb[dev]));
+    }
+    bi = b % BPB(sb[dev]);
+    if(bp->data[bi/8] & (1 << (bi % 8)))
+      panic("ballocrun");
+    bp->data[bi/8] |= 1 << (bi % 8);
+  }
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
+}
+
+// Blocks to be freed together by bfreebatch(): at most NBATCH
+// blocks, covered by at most NBATCHMAP free map blocks, so that
+// a batch is a bounded part of a transaction however scattered
+// the blocks are.
+#define NBATCH    64
+#define NBATCHMAP 4
+
+struct batch {
+  uint dev;
+  int n;
+  uint b[NBATCH];
+  int nmap;
+  uint map[NBATCHMAP];  // free map blocks covering b[]
+};
+
+// Add block b to bt. Returns 0 if bt is full.
+static int
+batchadd(struct batch *bt, uint b)
+{
+  uint mb = BBLOCK(b, sb[bt->dev]);
+  int i;
+
+  if(bt->n == NBATCH)
+    return 0;
+  for(i = 0; i < bt->nmap && bt->map[i] != mb; i++)
+    ;
+  if(i == bt->nmap){
+    if(bt->nmap == NBATCHMAP)
+      return 0;
+    bt->map[bt->nmap++] = mb;
+  }
+  bt->b[bt->n++] = b;
+  return 1;
+}
+
+// Free the blocks in bt, reading and logging each free map
+// block once.
+static void
+bfreebatch(struct batch *bt)
+{
+  struct buf *bp;
+  uint b, bi, m;
+  int i, j;
+
+  // insertion sort, so blocks in one free map block are adjacent.
+  for(i = 1; i < bt->n; i++){
+    b = bt->b[i];
+    for(j = i; j > 0 && bt->b[j-1] > b; j--)
+      bt->b[j] = bt->b[j-1];
+    bt->b[j] = b;
+  }
+
+  bp = 0;
+  for(i = 0; i < bt->n; i++){
+    b = bt->b[i];
+    if(bp == 0 || bp->blockno != BBLOCK(b, sb[bt->dev])){
+      if(bp){
+        log_write(bp);
+        brelse(bp);
+      }
+      bp = bread(bt->dev, BBLOCK(b, sb[bt->dev]));
+    }
+    bi = b % BPB(sb[bt->dev]);
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0)
+      panic("freeing free block");
+    bp->data[bi/8] &= ~m;
+  }
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
+  bt->n = bt->nmap = 0;
 }
 
 // Inodes.
@@ -171,37 +301,177 @@ bfree(int dev, uint b)
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+// Mount table.
+//
+// Each file system device has a table of functions for the parts
+// of the inode layer that depend on how files are stored; the
+// inode cache, directories and path names below are shared.
+// A file system other than the root is reached through the
+// directory its root is mounted on (see mount()).
+
+struct {
+  struct spinlock lock;        // protects covered
+  struct sleeplock mountlock;  // serializes mount() and umount()
+  struct mount {
+    struct fsops *ops;         // 0 until the device is set up
+    struct inode *covered;     // directory the root is mounted on
+  } m[NDEV];                   // indexed by device number
+} mtable;
+
+static struct fsops*
+fsops(uint dev)
+{
+  if(dev >= NDEV || mtable.m[dev].ops == 0)
+    panic("fsops");
+  return mtable.m[dev].ops;
+}
+
+// Make ops the functions for file system device dev.
+void
+fsregister(uint dev, struct fsops *ops)
+{
+  if(dev >= NDEV)
+    panic("fsregister");
+  mtable.m[dev].ops = ops;
+}
+
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  uint ifree[NDEV];  // hint: no inode below this number is free
 } icache;
 
+// An unlinked file with more than NDIRECT blocks is not freed by
+// the iput() that drops its last reference: iput() passes the
+// reference to the reclaim list, and ireclaim() frees the file a
+// batch of blocks at a time, in a transaction per batch. So rm of
+// a big file returns at once, and no one transaction has to free
+// a whole file. If the list is full, iput() frees the file itself.
+
+#define NRECLAIM 8
+
+static uint itrunc1(struct inode*);
+
+struct {
+  struct spinlock lock;
+  int n;
+  struct inode *ip[NRECLAIM];
+} reclaim;
+
+// The flusher kernel thread does the file system's background
+// work, off the paths of the system calls that make it: it
+// commits delayed transactions when they are due, and frees
+// the files on the reclaim list. Between jobs it sleeps until
+// flusherwake() says there is more.
+struct {
+  struct spinlock lock;
+  int work;  // flusherwake() has been called
+} flush;
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
+  initlock(&mtable.lock, "mtable");
+  initlock(&reclaim.lock, "reclaim");
+  initlock(&flush.lock, "flush");
+  initsleeplock(&mtable.mountlock, "mount");
+  for(i = 0; i < NDEV; i++)
+    icache.ifree[i] = 1;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
   }
 }
 
-static struct inode* iget(uint dev, uint inum);
+// The inode map (sb.imapstart) has one bit per inode, set
+// if the inode is allocated, so that ialloc() can find a free
+// inode by scanning a bitmap block instead of reading every
+// inode block. icache.ifree[dev] remembers where the free inodes
+// start; it is only a hint, and ialloc() still falls back to
+// a full scan.
+
+// Find a clear bit for an inode in [lo, hi), set it, and
+// return the inode number, or 0 if there is none.
+static uint
+imapclaim(uint dev, uint lo, uint hi)
+{
+  uint b, bi, m;
+  struct buf *bp;
+
+  for(b = lo - lo%BPB(sb[dev]); b < hi; b += BPB(sb[dev])){
+    bp = bread(dev, IMBLOCK(b, sb[dev]));
+    for(bi = (b < lo ? lo - b : 0); bi < BPB(sb[dev]) && b + bi < hi; bi++){
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+        bi += 7;  // skip a fully allocated byte
+        continue;
+      }
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0){  // Is inode free?
+        bp->data[bi/8] |= m;  // Mark inode in use.
+        log_write(bp);
+        brelse(bp);
+        return b + bi;
+      }
+    }
+    brelse(bp);
+  }
+  return 0;
+}
+
+// Mark inode inum free in the inode map.
+static void
+imapfree(uint dev, uint inum)
+{
+  struct buf *bp;
+  uint bi, m;
+
+  bp = bread(dev, IMBLOCK(inum, sb[dev]));
+  bi = inum % BPB(sb[dev]);
+  m = 1 << (bi % 8);
+  if((bp->data[bi/8] & m) == 0)
+    panic("freeing free inode");
+  bp->data[bi/8] &= ~m;
+  log_write(bp);
+  brelse(bp);
+
+  acquire(&icache.lock);
+  if(inum < icache.ifree[dev])
+    icache.ifree[dev] = inum;
+  release(&icache.lock);
+}
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
+// Prefer an inode at or after near (the parent directory's
+// inode), so that a directory and its files share inode blocks.
 // Returns an unlocked but allocated and referenced inode.
-struct inode*
-ialloc(uint dev, short type)
+static struct inode*
+disk_ialloc(uint dev, short type, uint near)
 {
-  int inum;
+  uint inum, start;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
+  acquire(&icache.lock);
+  start = icache.ifree[dev];
+  release(&icache.lock);
+  if(near > start && near < sb[dev].ninodes)
+    start = near;
+
+  for(;;){
+    if((inum = imapclaim(dev, start, sb[dev].ninodes)) == 0 &&
+       (inum = imapclaim(dev, 1, start)) == 0)
+      panic("ialloc: no inodes");
+
+    acquire(&icache.lock);
+    if(start == icache.ifree[dev] && inum >= start)  // [start, inum) all in use
+      icache.ifree[dev] = inum + 1;
+    release(&icache.lock);
+
+    bp = bread(dev, IBLOCK(inum, sb[dev]));
+    dip = (struct dinode*)bp->data + inum%IPB(sb[dev]);
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
@@ -209,37 +479,37 @@ ialloc(uint dev, short type)
       brelse(bp);
       return iget(dev, inum);
     }
+    // the map was stale; the bit is now set, so keep looking.
     brelse(bp);
   }
-  panic("ialloc: no inodes");
 }
 
-// Copy a modified in-memory inode to disk.
-// Must be called after every change to an ip->xxx field
-// that lives on disk, since i-node cache is write-through.
+// Copy a modified in-memory inode to disk; see iupdate().
 // Caller must hold ip->lock.
-void
-iupdate(struct inode *ip)
+static void
+disk_iupdate(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
+  dip = (struct dinode*)bp->data + ip->inum%IPB(sb[ip->dev]);
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->data, ip->data, sizeof(ip->data));
   log_write(bp);
   brelse(bp);
+  ip->synctid = log_tid(ip->dev);
 }
 
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode*
+struct inode*
 iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
@@ -283,29 +553,40 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Copy an on-disk inode into the in-memory one.
+// Caller must hold ip->lock.
+static void
+disk_iread(struct inode *ip)
+{
+  struct buf *bp;
+  struct dinode *dip;
+
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
+  dip = (struct dinode*)bp->data + ip->inum%IPB(sb[ip->dev]);
+  ip->type = dip->type;
+  ip->major = dip->major;
+  ip->minor = dip->minor;
+  ip->nlink = dip->nlink;
+  ip->size = dip->size;
+  memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+  memmove(ip->data, dip->data, sizeof(ip->data));
+  brelse(bp);
+  // any uncommitted update is in the open transaction.
+  ip->synctid = ip->datatid = log_tid(ip->dev);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
 ilock(struct inode *ip)
 {
-  struct buf *bp;
-  struct dinode *dip;
-
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    brelse(bp);
+    fsops(ip->dev)->iread(ip);
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -322,6 +603,96 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+static int
+reclaimadd(struct inode *ip)
+{
+  int r = 0;
+
+  acquire(&reclaim.lock);
+  if(reclaim.n < NRECLAIM){
+    reclaim.ip[reclaim.n++] = ip;
+    r = 1;
+  }
+  release(&reclaim.lock);
+  if(r)
+    flusherwake();
+  return r;
+}
+
+// Free a batch of blocks of a file on the reclaim list, and the
+// file itself once it has no blocks left; or, if all is set, free
+// every file on the list. Called by the flusher thread and before
+// writes, so freeing keeps ahead of allocation. Must not be
+// called inside a transaction.
+void
+ireclaim(int all)
+{
+  struct inode *ip;
+  uint left;
+
+  do {
+    acquire(&reclaim.lock);
+    if(reclaim.n == 0){
+      release(&reclaim.lock);
+      return;
+    }
+    ip = reclaim.ip[--reclaim.n];
+    release(&reclaim.lock);
+
+    do {
+      begin_op();
+      ilock(ip);
+      left = itrunc1(ip);
+      iunlock(ip);
+      if(left == 0)
+        iput(ip);  // frees the inode
+      end_op();
+    } while(left > 0 && (all || !reclaimadd(ip)));
+  } while(all);
+}
+
+// Tell the flusher there is work for it.
+void
+flusherwake(void)
+{
+  acquire(&flush.lock);
+  flush.work = 1;
+  wakeup(&flush);
+  release(&flush.lock);
+}
+
+// The flusher kernel thread's loop.
+void
+flusher(void *arg)
+{
+  int open;
+
+  for(;;){
+    acquire(&flush.lock);
+    flush.work = 0;
+    release(&flush.lock);
+
+    open = log_tick();
+    ireclaim(0);
+
+    if(reclaim.n > 0){  // unlocked peek
+      // more to free; let anyone else runnable go first.
+      yield();
+    } else if(open){
+      // check the open transaction again next tick.
+      acquire(&tickslock);
+      tickupdate();
+      timersleep(ticks + 1);
+      release(&tickslock);
+    } else {
+      acquire(&flush.lock);
+      if(flush.work == 0)
+        sleep(&flush, &flush.lock);
+      release(&flush.lock);
+    }
+  }
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
@@ -343,9 +714,12 @@ iput(struct inode *ip)
 
     release(&icache.lock);
 
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
+    // only disk inodes use addrs[NDIRECT].
+    if(ip->addrs[NDIRECT] && reclaimadd(ip)){
+      releasesleep(&ip->lock);
+      return;
+    }
+    fsops(ip->dev)->ifree(ip);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -369,8 +743,20 @@ iunlockput(struct inode *ip)
 //
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
+// are listed in ip->addrs[].  The next bsize/4 blocks are
 // listed in block ip->addrs[NDIRECT].
+//
+// A file of at most NINLINE bytes keeps its data in the inode
+// itself (ip->data) instead, so that reading it only touches the
+// inode block. When it grows past NINLINE bytes the data moves
+// to a block, and stays in blocks until the file is truncated.
+
+// Is ip's data in the inode rather than in blocks?
+static int
+isinline(struct inode *ip)
+{
+  return ip->addrs[0] == 0 && ip->size <= NINLINE;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -387,7 +773,7 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
+  if(bn < SB_NINDIRECT(sb[ip->dev])){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
       ip->addrs[NDIRECT] = addr = balloc(ip->dev);
@@ -404,36 +790,175 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Like bmap(), but return 0 rather than allocate a block.
+static uint
+bmapget(struct inode *ip, uint bn)
 {
-  int i, j;
+  uint addr;
   struct buf *bp;
-  uint *a;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+  if(bn >= SB_NINDIRECT(sb[ip->dev]) || ip->addrs[NDIRECT] == 0)
+    return 0;
+  bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  addr = ((uint*)bp->data)[bn];
+  brelse(bp);
+  return addr;
+}
+
+// Make addr the nth block of ip, which has none.
+static void
+bmapset(struct inode *ip, uint bn, uint addr)
+{
+  struct buf *bp;
+
+  if(bn < NDIRECT){
+    ip->addrs[bn] = addr;
+    return;
   }
+  if(ip->addrs[NDIRECT] == 0)
+    ip->addrs[NDIRECT] = balloc(ip->dev);
+  bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  ((uint*)bp->data)[bn - NDIRECT] = addr;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Return a locked buf holding the block of ip that contains
+// byte off, so that callers like filesend() can use file data
+// in place in the buffer cache. off must be below ip->size.
+// Returns 0 if the data is in ip->data instead.
+// Caller must hold ip->lock, and must brelse() the buf.
+static struct buf*
+disk_ibread(struct inode *ip, uint off)
+{
+  if(isinline(ip))
+    return 0;
+  return bread(ip->dev, bmap(ip, off/sb[ip->dev].bsize));
+}
+
+// Free one batch of ip's blocks, taken from the end of the file,
+// and shrink the file to the blocks that are left, so that it is
+// consistent after each batch. Returns the number of blocks left.
+// Caller must hold ip->lock.
+static uint
+itrunc1(struct inode *ip)
+{
+  struct batch bt;
+  struct buf *bp;
+  uint *a, left, bsize = sb[ip->dev].bsize;
+  int i;
+
+  bt.dev = ip->dev;
+  bt.n = bt.nmap = 0;
+  left = 0;
 
   if(ip->addrs[NDIRECT]){
     bp = bread(ip->dev, ip->addrs[NDIRECT]);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(i = SB_NINDIRECT(sb[ip->dev]) - 1; i >= 0; i--){
+      if(a[i] && !batchadd(&bt, a[i]))
+        break;
+      a[i] = 0;
+    }
+    if(i < 0 && batchadd(&bt, ip->addrs[NDIRECT])){
+      ip->addrs[NDIRECT] = 0;  // no need to log the emptied block
+    } else {
+      log_write(bp);
+      left = NDIRECT + i + 1;
+    }
+    brelse(bp);
+  }
+
+  if(ip->addrs[NDIRECT] == 0){
+    for(i = NDIRECT - 1; i >= 0; i--){
+      if(ip->addrs[i] && !batchadd(&bt, ip->addrs[i]))
+        break;
+      ip->addrs[i] = 0;
+    }
+    left = i + 1;
+  }
+
+  bfreebatch(&bt);
+  if(ip->size > left * bsize)
+    ip->size = left * bsize;
+  if(left == 0)
+    memset(ip->data, 0, sizeof(ip->data));
+  disk_iupdate(ip);
+  return left;
+}
+
+// Truncate inode (discard contents), freeing its blocks.
+// Caller must hold ip->lock.
+static void
+disk_itrunc(struct inode *ip)
+{
+  while(itrunc1(ip) > 0)
+    ;
+  ip->datatid = ip->synctid;
+}
+
+// Free ip, which has no links or references left.
+// Caller must hold ip->lock.
+static void
+disk_ifree(struct inode *ip)
+{
+  disk_itrunc(ip);
+  ip->type = 0;
+  disk_iupdate(ip);
+  imapfree(ip->dev, ip->inum);
+}
+
+static uint
+disk_bsize(uint dev)
+{
+  return sb[dev].bsize;
+}
+
+// Count free data blocks and free inodes by scanning the
+// free map and the inode map. Free runs of blocks are counted
+// within each free map block, so a run is split where one block
+// of the map ends; the difference is too small to matter here.
+static void
+disk_statfs(uint dev, struct statfs *st)
+{
+  struct buf *bp;
+  uint b, bi, run;
+
+  st->bsize = sb[dev].bsize;
+  st->blocks = sb[dev].nblocks;
+  st->files = sb[dev].ninodes - 1;  // inode 0 is never used
+  st->bfree = st->ffree = st->fextents = st->fmaxrun = 0;
+
+  for(b = 0; b < sb[dev].size; b += BPB(sb[dev])){
+    bp = bread(dev, BBLOCK(b, sb[dev]));
+    run = 0;
+    for(bi = 0; bi < BPB(sb[dev]) && b + bi < sb[dev].size; bi++){
+      if(b + bi < sb[dev].size - sb[dev].nblocks)
+        continue;  // meta data
+      if(bp->data[bi/8] & (1 << (bi % 8))){
+        run = 0;
+        continue;
+      }
+      st->bfree++;
+      if(run++ == 0)
+        st->fextents++;
+      if(run > st->fmaxrun)
+        st->fmaxrun = run;
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
-  ip->size = 0;
-  iupdate(ip);
+  for(b = 0; b < sb[dev].ninodes; b += BPB(sb[dev])){
+    bp = bread(dev, IMBLOCK(b, sb[dev]));
+    for(bi = (b == 0 ? 1 : 0); bi < BPB(sb[dev]) && b + bi < sb[dev].ninodes; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        st->ffree++;
+    }
+    brelse(bp);
+  }
 }
 
 // Copy stat information from inode.
@@ -448,14 +973,11 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
-// Read data from inode.
-// Caller must hold ip->lock.
-// If user_dst==1, then dst is a user virtual address;
-// otherwise, dst is a kernel address.
-int
-readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+// Read data from inode; see readi().
+static int
+disk_readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, bsize = sb[ip->dev].bsize;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -463,10 +985,16 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(isinline(ip)){
+    if(either_copyout(user_dst, dst, ip->data + off, n) == -1)
+      return 0;
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    bp = bread(ip->dev, bmap(ip, off/bsize));
+    m = min(n - tot, bsize - off%bsize);
+    if(either_copyout(user_dst, dst, bp->data + (off % bsize), m) == -1) {
       brelse(bp);
       break;
     }
@@ -475,25 +1003,50 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
-// Write data to inode.
-// Caller must hold ip->lock.
-// If user_src==1, then src is a user virtual address;
-// otherwise, src is a kernel address.
-int
-writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+// Move ip's inline data to a block of its own.
+static void
+unline(struct inode *ip)
 {
-  uint tot, m;
+  struct buf *bp;
+
+  if(ip->size > 0){
+    bp = bread(ip->dev, bmap(ip, 0));
+    memmove(bp->data, ip->data, ip->size);
+    log_write(bp);
+    brelse(bp);
+  }
+  memset(ip->data, 0, sizeof(ip->data));
+}
+
+// Write data to inode; see writei().
+static int
+disk_writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m, bsize = sb[ip->dev].bsize;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(off + n > SB_MAXFILE(sb[ip->dev])*bsize)
     return -1;
 
+  if(isinline(ip)){
+    if(off + n <= NINLINE){
+      if(either_copyin(ip->data + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      disk_iupdate(ip);
+      ip->datatid = ip->synctid;
+      return n;
+    }
+    unline(ip);  // too big for the inode
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+    bp = bread(ip->dev, bmap(ip, off/bsize));
+    m = min(n - tot, bsize - off%bsize);
+    if(either_copyin(bp->data + (off % bsize), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
@@ -507,12 +1060,255 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     // write the i-node back to disk even if the size didn't change
     // because the loop above might have called bmap() and added a new
     // block to ip->addrs[].
-    iupdate(ip);
+    disk_iupdate(ip);
+    ip->datatid = ip->synctid;
   }
 
   return n;
 }
 
+// Read or write ip for a file opened O_DIRECT, to or from user
+// address addr. A whole block that isn't in the buffer cache
+// moves by DMA straight between the disk and the user's page, so
+// a one-pass scan doesn't evict the blocks other processes use;
+// it borrows only the least recently used buffer, to keep the
+// block from being cached during the transfer.
+// Anything else goes through the cache: partial blocks, cached
+// blocks, inline data, and blocks that a write allocates, whose
+// allocation must be logged along with their contents. Blocks
+// read in for this are released as least recently used.
+// A block that is not cached was allocated by a committed
+// transaction, so the log has no copy that could overwrite a
+// direct write. The process can't free its pages while it is
+// in the system call, nor can its other threads, since a process
+// with threads never shrinks, so they needn't be pinned.
+// Caller must hold ip->lock, and be in a transaction to write.
+int
+rwdirect(struct inode *ip, int write, uint64 addr, uint off, uint n)
+{
+  uint tot, m, bn, bsize = sb[ip->dev].bsize;
+  uint64 pa;
+  struct buf *bp;
+  int r, cached;
+
+  if(isinline(ip))
+    return write ? disk_writei(ip, 1, addr, off, n) : disk_readi(ip, 1, addr, off, n);
+  if(off > ip->size || off + n < off)
+    return write ? -1 : 0;
+  if(write && off + n > SB_MAXFILE(sb[ip->dev])*bsize)
+    return -1;
+  if(!write && off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m, addr+=m){
+    m = min(n - tot, bsize - off%bsize);
+    bp = 0;
+    if(m == bsize && (pa = walkuser(myproc()->pagetable, addr, m, !write)) != 0 &&
+       (bn = bmapget(ip, off/bsize)) != 0){
+      // holding bp keeps the block out of the cache meanwhile.
+      bp = bpeek(ip->dev, bn);
+      if(!bp->valid){
+        bdirect(bp, pa, write);
+        continue;
+      }
+    }
+    cached = bp != 0;
+    if(!cached)
+      bp = bread(ip->dev, bmap(ip, off/bsize));
+    if(write){
+      r = either_copyin(bp->data + off%bsize, 1, addr, m);
+      if(r == 0)
+        log_write(bp);
+    } else
+      r = either_copyout(1, addr, bp->data + off%bsize, m);
+    if(cached)
+      brelse(bp);  // someone else is using it
+    else
+      bdrop(bp);
+    if(r == -1)
+      break;
+  }
+
+  if(write && tot > 0){
+    if(off > ip->size)
+      ip->size = off;
+    disk_iupdate(ip);
+    ip->datatid = ip->synctid;
+  }
+  if(write && tot < n)
+    return -1;  // bad user address
+  return tot;
+}
+
+// Give ip blocks for bytes [off, off+len), so that writing them
+// later needn't allocate. The blocks for each gap are taken as
+// one run of free blocks if possible, and are not zeroed, since
+// they are past the end of the file. ip->size doesn't change.
+// Returns 0 when done, 1 if this transaction has changed as
+// many free map blocks as it may and the caller should go on in
+// a new one, or -1 if the range is too big or the disk is full.
+// Caller must hold ip->lock, in a transaction.
+static int
+disk_prealloc(struct inode *ip, uint off, uint len)
+{
+  uint bsize = sb[ip->dev].bsize, bn, last, need, start, run, i, nmap, nalloc;
+
+  if(len == 0 || off + len < off || off + len > SB_MAXFILE(sb[ip->dev])*bsize)
+    return -1;
+  if(isinline(ip) && ip->size > 0)
+    unline(ip);
+
+  // one free map block is left for the indirect block.
+  nmap = 1;
+  nalloc = 0;
+  last = (off + len - 1) / bsize;
+  for(bn = off / bsize; bn <= last; bn += run){
+    run = 1;
+    if(bmapget(ip, bn))
+      continue;
+    for(need = 1; bn + need <= last && bmapget(ip, bn + need) == 0; need++)
+      ;
+    start = bfindrun(ip->dev, need, &run);
+    if(run == 0)
+      break;
+    nmap += BBLOCK(start + run - 1, sb[ip->dev]) - BBLOCK(start, sb[ip->dev]) + 1;
+    if(nmap > NBATCHMAP && nalloc > 0)
+      break;
+    ballocrun(ip->dev, start, run);
+    nalloc += run;
+    for(i = 0; i < run; i++)
+      bmapset(ip, bn + i, start + i);
+  }
+
+  disk_iupdate(ip);
+  ip->datatid = ip->synctid;
+  if(bn <= last)
+    return run == 0 ? -1 : 1;
+  return 0;
+}
+
+struct fsops diskfsops = {
+  .ialloc = disk_ialloc,
+  .iread = disk_iread,
+  .iupdate = disk_iupdate,
+  .itrunc = disk_itrunc,
+  .ifree = disk_ifree,
+  .readi = disk_readi,
+  .writei = disk_writei,
+  .ibread = disk_ibread,
+  .bsize = disk_bsize,
+  .statfs = disk_statfs,
+  .prealloc = disk_prealloc,
+};
+
+// The rest of the kernel calls these, which pass the call on
+// to the inode's file system.
+
+// Allocate an inode of type type on device dev.
+// Returns an unlocked but allocated and referenced inode.
+struct inode*
+ialloc(uint dev, short type, uint near)
+{
+  return fsops(dev)->ialloc(dev, type, near);
+}
+
+// Copy a modified in-memory inode to its file system.
+// Must be called after every change to an ip->xxx field
+// that lives on disk, since i-node cache is write-through.
+// Caller must hold ip->lock.
+void
+iupdate(struct inode *ip)
+{
+  fsops(ip->dev)->iupdate(ip);
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip)
+{
+  fsops(ip->dev)->itrunc(ip);
+}
+
+// Read data from inode.
+// Caller must hold ip->lock.
+// If user_dst==1, then dst is a user virtual address;
+// otherwise, dst is a kernel address.
+int
+readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  return fsops(ip->dev)->readi(ip, user_dst, dst, off, n);
+}
+
+// Write data to inode.
+// Caller must hold ip->lock.
+// If user_src==1, then src is a user virtual address;
+// otherwise, src is a kernel address.
+int
+writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  return fsops(ip->dev)->writei(ip, user_src, src, off, n);
+}
+
+// Return a locked buf holding the block of ip that contains
+// byte off, or 0 if ip's data is inline; see disk_ibread().
+// Only for file systems whose fsbsize() is not zero.
+struct buf*
+ibread(struct inode *ip, uint off)
+{
+  if(fsops(ip->dev)->ibread == 0)
+    panic("ibread");
+  return fsops(ip->dev)->ibread(ip, off);
+}
+
+// Allocate storage for bytes [off, off+len) of ip, if its file
+// system can; see disk_prealloc().
+int
+iprealloc(struct inode *ip, uint off, uint len)
+{
+  if(fsops(ip->dev)->prealloc == 0)
+    return -1;
+  return fsops(ip->dev)->prealloc(ip, off, len);
+}
+
+// Block size of the file system on device dev,
+// or 0 if it does not keep files in disk blocks.
+uint
+fsbsize(uint dev)
+{
+  return fsops(dev)->bsize(dev);
+}
+
+// Fill in st for the file system on device dev.
+void
+fsstat(uint dev, struct statfs *st)
+{
+  fsops(dev)->statfs(dev, st);
+  st->dev = dev;
+  if(st->bfree == 0 || st->fmaxrun == 0)
+    st->frag = 0;
+  else
+    st->frag = 100 - (uint64)100 * st->fmaxrun / st->bfree;
+}
+
+// Copy block bn of the disk file system on device dev to
+// user address dst, for fsck. Returns the block size, or -1.
+int
+fsreadblock(uint dev, uint bn, uint64 dst)
+{
+  struct buf *bp;
+  int n;
+
+  if(dev >= NDEV || mtable.m[dev].ops != &diskfsops || bn >= sb[dev].size)
+    return -1;
+  bp = bread(dev, bn);
+  n = sb[dev].bsize;
+  if(copyout(myproc()->pagetable, dst, (char*)bp->data, n) < 0)
+    n = -1;
+  brelse(bp);
+  return n;
+}
+
 // Directories
 
 int
@@ -618,6 +1414,150 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Mount the file system on device dev on directory path.
+// A disk file system is set up the first time it is mounted.
+int
+mount(char *path, uint dev)
+{
+  struct inode *ip;
+
+  if(dev >= NDEV || dev == ROOTDEV)
+    return -1;
+  acquiresleep(&mtable.mountlock);
+  if(mtable.m[dev].covered != 0)
+    goto bad;
+  // outside a transaction, since it adds a log.
+  if(mtable.m[dev].ops == 0 && fsinit(dev) < 0)
+    goto bad;
+
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    goto bad;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR || (ip->dev == ROOTDEV && ip->inum == ROOTINO) ||
+     ismounted(ip)){
+    iunlockput(ip);
+    end_op();
+    goto bad;
+  }
+  iunlock(ip);
+  acquire(&mtable.lock);
+  mtable.m[dev].covered = ip;  // keeps the reference
+  release(&mtable.lock);
+  end_op();
+
+  releasesleep(&mtable.mountlock);
+  return 0;
+
+bad:
+  releasesleep(&mtable.mountlock);
+  return -1;
+}
+
+// Unmount the file system whose root is path. Fails if any
+// of its files are in use, as open files or current directories.
+int
+umount(char *path)
+{
+  struct inode *ip, *ip1, *mp;
+  uint dev;
+
+  ireclaim(1);  // files waiting to be freed hold references
+  acquiresleep(&mtable.mountlock);
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    goto bad;
+  }
+  dev = ip->dev;
+  mp = mtable.m[dev].covered;
+  if(ip->inum != ROOTINO || mp == 0)
+    goto busy;
+  acquire(&icache.lock);
+  for(ip1 = &icache.inode[0]; ip1 < &icache.inode[NINODE]; ip1++){
+    if(ip1->dev == dev && ip1->ref > (ip1 == ip ? 1 : 0)){
+      release(&icache.lock);
+      goto busy;
+    }
+  }
+  release(&icache.lock);
+
+  acquire(&mtable.lock);
+  mtable.m[dev].covered = 0;
+  release(&mtable.lock);
+  iput(mp);
+  iput(ip);
+  end_op();
+  releasesleep(&mtable.mountlock);
+
+  // don't leave delayed writes behind.
+  log_force(dev, log_tid(dev));
+  return 0;
+
+busy:
+  iput(ip);
+  end_op();
+bad:
+  releasesleep(&mtable.mountlock);
+  return -1;
+}
+
+// Is a file system mounted on ip?
+int
+ismounted(struct inode *ip)
+{
+  int i, r = 0;
+
+  acquire(&mtable.lock);
+  for(i = 0; i < NDEV; i++){
+    if(mtable.m[i].covered == ip)
+      r = 1;
+  }
+  release(&mtable.lock);
+  return r;
+}
+
+// If a file system is mounted on ip, put ip and return
+// that file system's root instead.
+static struct inode*
+mountroot(struct inode *ip)
+{
+  int dev;
+
+  acquire(&mtable.lock);
+  for(dev = 0; dev < NDEV; dev++){
+    if(mtable.m[dev].covered == ip){
+      release(&mtable.lock);
+      iput(ip);
+      return iget(dev, ROOTINO);
+    }
+  }
+  release(&mtable.lock);
+  return ip;
+}
+
+// If ip is the root of a mounted file system, put ip and
+// return the directory it is mounted on, whose ".." is the
+// parent of ip's root.
+static struct inode*
+mountpoint(struct inode *ip)
+{
+  struct inode *mp;
+
+  if(ip->inum != ROOTINO || ip->dev == ROOTDEV)
+    return ip;
+  acquire(&mtable.lock);
+  mp = mtable.m[ip->dev].covered;
+  release(&mtable.lock);
+  if(mp == 0)
+    return ip;
+  idup(mp);
+  iput(ip);
+  return mp;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
@@ -633,6 +1573,8 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(namecmp(name, "..") == 0 && !(nameiparent && *path == '\0'))
+      ip = mountpoint(ip);
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -648,7 +1590,7 @@ namex(char *path, int nameiparent, char *name)
       return 0;
     }
     iunlockput(ip);
-    ip = next;
+    ip = mountroot(next);
   }
   if(nameiparent){
     iput(ip);
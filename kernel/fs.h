@@ -3,14 +3,19 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+#define BSIZE 1024  // default block size
+#define MAXBSIZE 4096  // largest block size
+#define SBOFF 1024  // byte offset of super block on disk
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                          inode bit map | free bit map | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
-// super block describes the disk layout:
+// super block describes the disk layout, in units of the block size
+// that mkfs was told to use. The super block is always at byte SBOFF,
+// so with blocks bigger than SBOFF it shares block 0 with the boot
+// block:
 struct superblock {
   uint magic;        // Must be FSMAGIC
   uint size;         // Size of file system image (blocks)
@@ -20,6 +25,8 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint imapstart;    // Block number of first inode map block
+  uint bsize;        // Block size (bytes)
 };
 
 #define FSMAGIC 0x10203040
@@ -27,6 +34,12 @@ struct superblock {
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
+#define NINLINE 64  // bytes of data a file can keep in its inode
+
+// NINDIRECT and MAXFILE for a file system with super block sb,
+// rather than one with the default block size.
+#define SB_NINDIRECT(sb) ((sb).bsize / sizeof(uint))
+#define SB_MAXFILE(sb)   (NDIRECT + SB_NINDIRECT(sb))
 
 // On-disk inode structure
 struct dinode {
@@ -36,19 +49,23 @@ struct dinode {
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
   uint addrs[NDIRECT+1];   // Data block addresses
-};
+  char data[NINLINE];      // Contents, if at most NINLINE bytes
+};                         //   and addrs[0] == 0
 
 // Inodes per block.
-#define IPB           (BSIZE / sizeof(struct dinode))
+#define IPB(sb)       ((sb).bsize / sizeof(struct dinode))
 
 // Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
+#define IBLOCK(i, sb)     ((i) / IPB(sb) + sb.inodestart)
 
 // Bitmap bits per block
-#define BPB           (BSIZE*8)
+#define BPB(sb)       ((sb).bsize*8)
 
 // Block of free map containing bit for block b
-#define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
+#define BBLOCK(b, sb) ((b)/BPB(sb) + sb.bmapstart)
+
+// Block of inode map containing bit for inode i
+#define IMBLOCK(i, sb) ((i)/BPB(sb) + sb.imapstart)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
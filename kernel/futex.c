@@ -0,0 +1,104 @@
+// Futexes: sleeping and waking on an int in user memory, so
+// that user-space locks need enter the kernel only when there
+// is contention.
+//
+// A futex is named by the physical address of the int, which
+// is the same for every thread sharing the page, and that
+// address is the channel its waiters sleep on in the hashed
+// wait queues. A lock from a small table, picked by the same
+// address, makes futexwait()'s check of the int and its sleep
+// atomic with respect to futexwake().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 31
+#define FUTEXLOCK(pa) (&futexlock[((pa) >> 2) % NFUTEX])
+
+static struct spinlock futexlock[NFUTEX];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futexlock[i], "futex");
+}
+
+// Physical address of the int at user address addr, or 0 if
+// addr isn't an aligned address in the process's memory. The
+// page can't be freed while the caller is in a system call:
+// only a process without threads shrinks.
+static uint64
+futexaddr(uint64 addr)
+{
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0)
+    return 0;
+  if((pa = walkaddr(myproc()->pagetable, PGROUNDDOWN(addr))) == 0)
+    return 0;
+  return pa + addr % PGSIZE;
+}
+
+// If the int at user address addr holds val, sleep until a
+// futexwake() on it, or a kill(), or until mtime() reaches
+// when, if when isn't 0. Returns 0 when woken, which may be
+// spuriously, or 1 on timeout; -1 if the int doesn't hold
+// val, addr is bad, or the process has been killed.
+int
+futexwait(uint64 addr, int val, uint64 when)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+  int r;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  lk = FUTEXLOCK(pa);
+  for(;;){
+    if(when)
+      timerset(when, (void*)pa, lk);
+    acquire(lk);
+    if(*(volatile int*)pa != val || p->killed){
+      r = -1;
+    } else if(when && timerfired()){
+      r = 1;
+    } else {
+      sleep((void*)pa, lk);
+      r = p->killed ? -1 : 0;
+      if(r == 0 && when && timerfired())
+        r = 1;
+    }
+    release(lk);
+    if(when == 0)
+      return r;
+    timercancel();
+    if(r != 1 || mtime() >= when)
+      return r;
+    // the timer's whole ticks ran out early; wait out the rest.
+  }
+}
+
+// Wake at most n processes waiting on the int at user address
+// addr. Returns the number woken, or -1.
+int
+futexwake(uint64 addr, int n)
+{
+  struct spinlock *lk;
+  uint64 pa;
+  int r;
+
+  if(n < 0 || (pa = futexaddr(addr)) == 0)
+    return -1;
+  lk = FUTEXLOCK(pa);
+  acquire(lk);
+  r = wakeupn((void*)pa, n);
+  release(lk);
+  return r;
+}
@@ -21,6 +21,19 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// With COMMITTICKS > 0, end_op() does not commit straight away
+// but lets further system calls join the transaction until it
+// is COMMITTICKS old or the log is nearly full; the flusher
+// thread's log_tick() commits transactions that have waited
+// long enough. Each transaction has a number (its log's seq
+// while it is open), and log_force() waits for a given
+// transaction to be committed, which is what fsync() uses.
+//
+// Each block device has its own log, for the file system on it.
+// A system call may touch several file systems (when looking up
+// a path, say), so begin_op() and end_op() bracket the call in
+// every log, always in device order.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -44,38 +57,76 @@ struct log {
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
   int dev;
+  uint seq;        // number of transactions committed so far.
+  uint delay;      // ticks a transaction may stay open; 0 = none.
+  uint deadline;   // when to commit the open transaction.
+  int force;       // someone is waiting in log_force().
+  int used;        // dev is a block device.
   struct logheader lh;
 };
-struct log log;
+struct log log[NDEV];  // indexed by device number
+
+static void recover_from_log(struct log*);
+static void commit(struct log*);
+
+// Set up an empty log for each block device, before any
+// system calls.
+void
+loginit(void)
+{
+  struct log *lg;
 
-static void recover_from_log(void);
-static void commit();
+  for(lg = log; lg < &log[NDEV]; lg++){
+    initlock(&lg->lock, "log");
+    lg->used = bdev(lg - log);
+    lg->dev = lg - log;
+    lg->delay = COMMITTICKS;
+  }
+}
 
+// Start logging for the file system on dev, recovering
+// any committed transaction. Other system calls may be
+// running, but none can have touched dev.
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  struct log *lg = &log[dev];
+
+  if (sizeof(struct logheader) >= sb->bsize)
     panic("initlog: too big logheader");
+  if (!lg->used)
+    panic("initlog: not a block device");
+
+  // keep commit() away while the log is replayed.
+  acquire(&lg->lock);
+  while(lg->committing || lg->outstanding > 0)
+    sleep(lg, &lg->lock);
+  lg->committing = 1;
+  release(&lg->lock);
 
-  initlock(&log.lock, "log");
-  log.start = sb->logstart;
-  log.size = sb->nlog;
-  log.dev = dev;
-  recover_from_log();
+  lg->start = sb->logstart;
+  lg->size = sb->nlog;
+  recover_from_log(lg);
+
+  acquire(&lg->lock);
+  lg->committing = 0;
+  wakeup(lg);
+  release(&lg->lock);
 }
 
 // Copy committed blocks from log to their home location
 static void
-install_trans(void)
+install_trans(struct log *lg, int recovering)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+  for (tail = 0; tail < lg->lh.n; tail++) {
+    struct buf *lbuf = bread(lg->dev, lg->start+tail+1); // read log block
+    struct buf *dbuf = bread(lg->dev, lg->lh.block[tail]); // read dst
+    memmove(dbuf->data, lbuf->data, lbuf->size);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
+    if(recovering == 0)
+      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -83,14 +134,14 @@ install_trans(void)
 
 // Read the log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(struct log *lg)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(lg->dev, lg->start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  lg->lh.n = lh->n;
+  for (i = 0; i < lg->lh.n; i++) {
+    lg->lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -99,90 +150,195 @@ read_head(void)
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct log *lg)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(lg->dev, lg->start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lg->lh.n;
+  for (i = 0; i < lg->lh.n; i++) {
+    hb->block[i] = lg->lh.block[i];
   }
   bwrite(buf);
   brelse(buf);
 }
 
 static void
-recover_from_log(void)
+recover_from_log(struct log *lg)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  read_head(lg);
+  install_trans(lg, 1); // if committed, copy from log to disk
+  lg->lh.n = 0;
+  write_head(lg); // clear the log
 }
 
-// called at the start of each FS system call.
-void
-begin_op(void)
+static void
+begin_op1(struct log *lg)
 {
-  acquire(&log.lock);
+  acquire(&lg->lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    if(lg->committing){
+      sleep(lg, &lg->lock);
+    } else if(lg->lh.n + (lg->outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      sleep(lg, &lg->lock);
     } else {
-      log.outstanding += 1;
-      release(&log.lock);
+      lg->outstanding += 1;
+      release(&lg->lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
+{
+  struct log *lg;
+
+  for(lg = log; lg < &log[NDEV]; lg++){
+    if(lg->used)
+      begin_op1(lg);
+  }
+}
+
+// Should the open transaction be committed now that no FS
+// system calls are active? Always, unless commits are delayed.
+// Caller holds lg->lock.
+static int
+wantcommit(struct log *lg)
 {
-  int do_commit = 0;
+  if(lg->delay == 0 || lg->force)
+    return 1;
+  if(lg->lh.n == 0)
+    return 0;
+  // begin_op() waits for a commit once the log is this full.
+  if(lg->lh.n + MAXOPBLOCKS > LOGSIZE)
+    return 1;
+  return (int)(ticks - lg->deadline) >= 0;
+}
+
+// Commit the open transaction. Caller holds lg->lock,
+// which is released around the disk writes.
+static void
+docommit(struct log *lg)
+{
+  lg->committing = 1;
+  lg->force = 0;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&lg->lock);
+  commit(lg);
+  acquire(&lg->lock);
+  lg->committing = 0;
+  lg->seq++;
+  wakeup(lg);
+}
 
-  acquire(&log.lock);
-  log.outstanding -= 1;
-  if(log.committing)
+static void
+end_op1(struct log *lg)
+{
+  acquire(&lg->lock);
+  lg->outstanding -= 1;
+  if(lg->committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(lg->outstanding == 0 && wantcommit(lg)){
+    docommit(lg);
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing lg->outstanding has decreased
     // the amount of reserved space.
-    wakeup(&log);
+    wakeup(lg);
+  }
+  release(&lg->lock);
+}
+
+// called at the end of each FS system call.
+// commits each log if this was the last outstanding
+// operation, unless commits are being delayed.
+void
+end_op(void)
+{
+  struct log *lg;
+
+  for(lg = log; lg < &log[NDEV]; lg++){
+    if(lg->used)
+      end_op1(lg);
+  }
+}
+
+// Number of the open transaction on dev. An FS system call's
+// log_write()s all go to the transaction that was open
+// when it called begin_op().
+uint
+log_tid(uint dev)
+{
+  struct log *lg = &log[dev];
+  uint tid;
+
+  acquire(&lg->lock);
+  tid = lg->seq;
+  release(&lg->lock);
+  return tid;
+}
+
+// Wait until transaction tid on dev has been committed,
+// committing it early if necessary. Must not be called inside
+// a transaction or while holding an inode lock.
+void
+log_force(uint dev, uint tid)
+{
+  struct log *lg;
+
+  if(dev >= NDEV || !log[dev].used)
+    return;
+  lg = &log[dev];
+  acquire(&lg->lock);
+  while((int)(lg->seq - tid) <= 0){
+    if(lg->committing || lg->outstanding > 0){
+      // the last end_op() will see lg->force.
+      lg->force = 1;
+      sleep(lg, &lg->lock);
+    } else {
+      docommit(lg);
+    }
   }
-  release(&log.lock);
-
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+  release(&lg->lock);
+}
+
+// Called by the flusher thread, to commit delayed transactions
+// that have been open long enough. Returns non-zero if some
+// delayed transaction is still open, to be committed later.
+int
+log_tick(void)
+{
+  struct log *lg;
+  int open = 0;
+
+  for(lg = log; lg < &log[NDEV]; lg++){
+    if(!lg->used || lg->delay == 0 || lg->lh.n == 0)  // unlocked peek
+      continue;
+    acquire(&lg->lock);
+    if(!lg->committing && lg->outstanding == 0 && wantcommit(lg) &&
+       lg->lh.n > 0)
+      docommit(lg);
+    if(lg->lh.n > 0)
+      open = 1;
+    release(&lg->lock);
   }
+  return open;
 }
 
 // Copy modified blocks from cache to log.
 static void
-write_log(void)
+write_log(struct log *lg)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
+  for (tail = 0; tail < lg->lh.n; tail++) {
+    struct buf *to = bread(lg->dev, lg->start+tail+1); // log block
+    struct buf *from = bread(lg->dev, lg->lh.block[tail]); // cache block
+    memmove(to->data, from->data, from->size);
     bwrite(to);  // write the log
     brelse(from);
     brelse(to);
@@ -190,14 +346,14 @@ write_log(void)
 }
 
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+commit(struct log *lg)
+{
+  if (lg->lh.n > 0) {
+    write_log(lg);     // Write modified blocks from cache to log
+    write_head(lg);    // Write header to disk -- the real commit
+    install_trans(lg, 0); // Now install writes to home locations
+    lg->lh.n = 0;
+    write_head(lg);    // Erase the transaction from the log
   }
 }
 
@@ -213,23 +369,28 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct log *lg = &log[b->dev];
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (lg->lh.n >= LOGSIZE || lg->lh.n >= lg->size - 1)
     panic("too big a transaction");
-  if (log.outstanding < 1)
+  if (lg->outstanding < 1)
     panic("log_write outside of trans");
 
-  acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  acquire(&lg->lock);
+  for (i = 0; i < lg->lh.n; i++) {
+    if (lg->lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  lg->lh.block[i] = b->blockno;
+  if (i == lg->lh.n) {  // Add new block to log?
+    if (lg->lh.n == 0 && lg->delay){
+      lg->deadline = ticks + lg->delay;
+      flusherwake();  // to commit it at the deadline
+    }
     bpin(b);
-    log.lh.n++;
+    lg->lh.n++;
   }
-  release(&log.lock);
+  release(&lg->lock);
 }
 
@@ -20,14 +20,18 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    futexinit();     // futex locks
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    tmpfsinit();     // in-memory file system
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
+    ramdiskinit();   // memory disk, if any
+    loginit();       // a log for each disk
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -62,6 +62,11 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   ...
+//   THREADFRAME(i) (trapframe of a thread in slot i of proc[])
+//   VDSO (p->vdso, read-only for user code)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define VDSO (TRAPFRAME - PGSIZE)
+#define THREADFRAME(i) (VDSO - ((i)+1)*PGSIZE)
@@ -1,13 +1,30 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         3  // scheduling priority levels; 0 runs first
+#define BOOSTTICKS   25  // ticks between boosts of all procs to their nice level
+#define MTIMEHZ  10000000  // CLINT mtime frequency in qemu
+#define TICKCYCLES 1000000  // CLINT cycles per clock tick; about 1/10th second in qemu
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#define VIRTIODEV     1  // device number of virtio disk
+#define TMPDEV        2  // device number of in-memory file system
+#define RAMDEV        3  // device number of ramdisk
+#ifndef RAMDISKSIZE
+#define RAMDISKSIZE   0  // ramdisk size in BSIZE blocks; 0 = none
+#endif
+#ifdef RAMROOT
+#define ROOTDEV  RAMDEV  // device number of file system root disk
+#else
+#define ROOTDEV  VIRTIODEV
+#endif
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*4)  // size of disk block cache
+#ifndef COMMITTICKS
+#define COMMITTICKS   0  // ticks to delay log commits; 0 = commit in end_op
+#endif
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
@@ -99,6 +99,49 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
   return i;
 }
 
+// Wait until there is room in the pipe, and return how much.
+// Returns -1 if the read end is closed or we are killed.
+int
+pipespace(struct pipe *pi)
+{
+  int n;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->nwrite == pi->nread + PIPESIZE){
+    if(pi->readopen == 0 || pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  n = pi->readopen ? PIPESIZE - (pi->nwrite - pi->nread) : -1;
+  release(&pi->lock);
+  return n;
+}
+
+// Copy up to n bytes from kernel address src into the pipe,
+// without sleeping, for callers that hold a buffer cache block.
+// Returns the number of bytes copied, or -1 if the read end
+// is closed.
+int
+pipeput(struct pipe *pi, char *src, int n)
+{
+  int i;
+
+  acquire(&pi->lock);
+  if(pi->readopen == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  for(i = 0; i < n && pi->nwrite != pi->nread + PIPESIZE; i++)
+    pi->data[pi->nwrite++ % PIPESIZE] = src[i];
+  wakeup(&pi->nread);
+  release(&pi->lock);
+  return i;
+}
+
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
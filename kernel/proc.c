@@ -5,31 +5,60 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vdso.h"
 
 struct cpu cpus[NCPU];
+static uint cpuson;  // bit i set once CPU i is scheduling
 
 struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Sleeping processes, on lists hashed by channel, so that
+// wakeup() looks only at processes that might be waiting
+// on its channel. A process joins a list in sleep() and is
+// taken off by wakeup(), or by itself when it returns from
+// sleep() after some other kind of wakeup (kill(), exit()).
+#define NWAITQ 61
+#define WQHASH(chan) (((uint64)(chan) >> 3) % NWAITQ)
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+  uint seq;             // Counts insertions
+} waitq[NWAITQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
+static int pickcpu(uint mask);
+static void kick(struct cpu *c, uint mask);
 
 extern char trampoline[]; // trampoline.S
 
+// Ticks a process may run at priority level prio before
+// it moves down a level.
+#define QUANTUM(prio) (1 << (prio))
+
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
   struct proc *p;
+  struct cpu *c;
   
   initlock(&pid_lock, "nextpid");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->runq.lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->memlock, "memlock");
 
       // Allocate a page for the process's kernel stack.
       // Map it high in memory, followed by an invalid
@@ -89,8 +118,9 @@ allocpid() {
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
+// A kernel thread (user == 0) gets no trapframe or page table.
 static struct proc*
-allocproc(void)
+allocproc(int user)
 {
   struct proc *p;
 
@@ -106,6 +136,12 @@ allocproc(void)
 
 found:
   p->pid = allocpid();
+  p->prio = p->nice = p->slice = 0;
+  p->rticks = p->wticks = p->nsched = 0;
+  p->affinity = ~0;
+  p->trapva = TRAPFRAME;
+  if(!user)
+    goto context;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -113,6 +149,17 @@ found:
     return 0;
   }
 
+  // Allocate the vDSO page.
+  if((p->vdso = (struct vdso *)kalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  memset(p->vdso, 0, PGSIZE);
+  p->vdso->pid = p->pid;
+  p->vdso->mtimehz = MTIMEHZ;
+  p->vdso->tickcycles = TICKCYCLES;
+
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
@@ -121,6 +168,7 @@ found:
     return 0;
   }
 
+context:
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -139,12 +187,21 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
+  if(p->vdso)
+    kfree((void*)p->vdso);
+  p->vdso = 0;
+  if(p->leader){
+    // a thread: the page table is its process's.
+    acquire(&p->leader->memlock);
+    uvmunmap(p->pagetable, p->trapva, 1, 0);
+    release(&p->leader->memlock);
+  } else if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
+  p->leader = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
@@ -182,6 +239,16 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the vDSO page just below TRAPFRAME, read-only
+  // for user code.
+  if(mappages(pagetable, VDSO, PGSIZE,
+              (uint64)(p->vdso), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -192,6 +259,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, VDSO, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -213,7 +281,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(1);
   initproc = p;
   
   // allocate one user page and copy init's instructions
@@ -228,29 +296,44 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  p->cpu = 0;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Grow or shrink user memory by n bytes, for all the threads
+// of the current process. Return the old size on success, -1
+// on failure. A process with threads can't shrink, since
+// another CPU may be running one of them with the freed pages
+// still in its TLB.
+uint64
 growproc(int n)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz, oldsz;
+  struct proc *t, *p = myproc();
+  struct proc *lp = p->leader ? p->leader : p;
 
-  sz = p->sz;
+  acquire(&lp->memlock);
+  oldsz = sz = p->sz;
   if(n > 0){
     if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+      release(&lp->memlock);
       return -1;
     }
   } else if(n < 0){
+    if(threaded(p)){
+      release(&lp->memlock);
+      return -1;
+    }
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
-  return 0;
+  lp->sz = sz;
+  for(t = proc; t < &proc[NPROC]; t++)
+    if(t->leader == lp)
+      t->sz = sz;
+  release(&lp->memlock);
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -263,7 +346,7 @@ fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(1)) == 0){
     return -1;
   }
 
@@ -293,13 +376,192 @@ fork(void)
 
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  np->cpu = p->cpu;
+  np->nice = np->prio = p->nice;
+  np->affinity = p->affinity;
+  setrunnable(np);
 
   release(&np->lock);
 
   return pid;
 }
 
+// Create a thread of the current process, which starts in
+// fn(arg) with its stack pointer at stack. It shares the
+// process's memory, and starts with the caller's open files
+// and current directory, shared as across fork(). Returns the
+// thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *lp = p->leader ? p->leader : p;
+
+  // Allocate process, without a page table of its own.
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+
+  // Give it a trapframe, mapped in the shared page table
+  // at a page picked by np's slot in proc[].
+  if((np->trapframe = (struct trapframe *)kalloc()) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapva = THREADFRAME(np - proc);
+  acquire(&lp->memlock);
+  if(mappages(p->pagetable, np->trapva, PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    release(&lp->memlock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->pagetable = p->pagetable;
+  np->sz = lp->sz;
+  np->leader = lp;
+  release(&lp->memlock);
+
+  // the first thread joins them all.
+  np->parent = lp;
+
+  // start in fn(arg), on the new stack.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack - stack % 16;
+  np->trapframe->ra = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  np->cpu = p->cpu;
+  np->nice = np->prio = p->nice;
+  np->affinity = p->affinity;
+  setrunnable(np);
+
+  release(&np->lock);
+
+  return pid;
+}
+
+// Is p a thread, or a process with threads, running or not
+// yet joined? Only p and its threads can make it one.
+int
+threaded(struct proc *p)
+{
+  struct proc *t;
+
+  if(p->leader)
+    return 1;
+  for(t = proc; t < &proc[NPROC]; t++)
+    if(t->leader == p)
+      return 1;
+  return 0;
+}
+
+// Kill p's threads, wait for each to exit, and free them, so
+// that nothing else is using p's memory when p exits.
+static void
+threadsexit(struct proc *p)
+{
+  struct proc *t;
+  int n;
+
+  acquire(&p->lock);
+  do {
+    n = 0;
+    for(t = proc; t < &proc[NPROC]; t++){
+      // t->leader is read without t->lock, as wait()
+      // reads np->parent.
+      if(t->leader != p)
+        continue;
+      acquire(&t->lock);
+      if(t->state == ZOMBIE){
+        freeproc(t);
+      } else {
+        t->killed = 1;
+        if(t->state == SLEEPING)
+          setrunnable(t);
+        n++;
+      }
+      release(&t->lock);
+    }
+    if(n > 0)
+      sleep(p, &p->lock);
+  } while(n > 0);
+  release(&p->lock);
+}
+
+// A kernel thread's fn has returned. Like exit(), but there
+// are no files to close, and the parent is always init.
+static void
+kthreadexit(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&initproc->lock);
+  acquire(&p->lock);
+  wakeup1(initproc);
+  p->xstate = 0;
+  p->state = ZOMBIE;
+  release(&initproc->lock);
+
+  sched();
+  panic("zombie kthread exit");
+}
+
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadstart.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn(p->karg);
+  kthreadexit();
+}
+
+// Create a kernel thread that runs fn(arg), called name for
+// procdump(). It has its own kernel stack and context and is
+// scheduled like any process, but has no user memory, open
+// files or current directory; init reaps it if fn returns.
+// Returns the thread's pid, or -1.
+int
+kthread_create(void (*fn)(void*), void *arg, char *name)
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc(0)) == 0)
+    return -1;
+  p->context.ra = (uint64)kthreadstart;
+  p->kfn = fn;
+  p->karg = arg;
+  p->parent = initproc;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+
+  p->cpu = pickcpu(p->affinity);
+  setrunnable(p);
+
+  release(&p->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -328,7 +590,10 @@ reparent(struct proc *p)
 
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
-// until its parent calls wait().
+// until its parent calls wait(). A thread exits
+// alone, and remains until the process's first
+// thread calls join(); the first thread takes
+// all the others with it.
 void
 exit(int status)
 {
@@ -337,6 +602,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  if(p->leader == 0 && threaded(p))
+    threadsexit(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -392,10 +660,12 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child of the current process to exit and
+// return its pid: a child process, or if threads is set, a
+// thread, the one numbered tid unless tid is 0.
+// Return -1 if there is no such child.
+static int
+waitchild(uint64 addr, int threads, int tid)
 {
   struct proc *np;
   int havekids, pid;
@@ -412,7 +682,8 @@ wait(uint64 addr)
       // this code uses np->parent without holding np->lock.
       // acquiring the lock first would cause a deadlock,
       // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
+      if(np->parent == p && (np->leader != 0) == threads &&
+         (tid == 0 || np->pid == tid)){
         // np->parent can't change between the check and the acquire()
         // because only the parent changes it, and we're the parent.
         acquire(&np->lock);
@@ -446,47 +717,328 @@ wait(uint64 addr)
   }
 }
 
-// Per-CPU process scheduler.
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return waitchild(addr, 0, 0);
+}
+
+// Wait for thread tid of the current process, or any thread
+// if tid is 0, to exit, and return its pid. Only the process's
+// first thread may join. Return -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  if(myproc()->leader)
+    return -1;
+  return waitchild(addr, 1, tid);
+}
+
+// Every BOOSTTICKS all processes move back up to their nice
+// level, so that CPU-bound ones on the low levels don't starve.
+// Processes and run queues notice a new boost lazily, by
+// comparing this with the last one they applied.
+static uint
+curboost(void)
+{
+  return ticks / BOOSTTICKS;
+}
+
+// Apply any boost p has missed. Caller must hold p->lock.
+static void
+boostproc(struct proc *p)
+{
+  if(p->boost != curboost()){
+    p->boost = curboost();
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+}
+
+// Append p to rq's queue for level prio, without counting it.
+// Caller must hold rq->lock.
+static void
+rqappend(struct runq *rq, struct proc *p, int prio)
+{
+  p->rqnext = 0;
+  if(rq->tail[prio])
+    rq->tail[prio]->rqnext = p;
+  else
+    rq->head[prio] = p;
+  rq->tail[prio] = p;
+}
+
+// Unlink p, which follows prev, from rq's queue for level
+// prio, and uncount it. Caller must hold rq->lock.
+static void
+rqunlink(struct runq *rq, int prio, struct proc *prev, struct proc *p)
+{
+  if(prev)
+    prev->rqnext = p->rqnext;
+  else
+    rq->head[prio] = p->rqnext;
+  if(rq->tail[prio] == p)
+    rq->tail[prio] = prev;
+  rq->n--;
+}
+
+// Take p off rq and return 1, or return 0 if it isn't
+// there because a CPU has just taken it to run.
+// Caller must hold rq->lock.
+static int
+rqremove(struct runq *rq, struct proc *p)
+{
+  struct proc *q, *prev;
+  int i;
+
+  for(i = 0; i < NPRIO; i++){
+    prev = 0;
+    for(q = rq->head[i]; q; prev = q, q = q->rqnext){
+      if(q == p){
+        rqunlink(rq, i, prev, p);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Move every process queued on rq up to its nice level.
+// Caller must hold rq->lock. p->nice is read without
+// p->lock; a stale value only puts p on the wrong level
+// until it next runs.
+static void
+rqboost(struct runq *rq)
+{
+  struct proc *p, *next;
+  int i;
+
+  rq->boost = curboost();
+  for(i = 1; i < NPRIO; i++){
+    p = rq->head[i];
+    rq->head[i] = rq->tail[i] = 0;
+    for(; p; p = next){
+      next = p->rqnext;
+      rqappend(rq, p, p->nice);
+    }
+  }
+}
+
+// Return the CPU in mask with the shortest run queue.
+static int
+pickcpu(uint mask)
+{
+  int i, best = -1;
+
+  for(i = 0; i < NCPU; i++){
+    if((mask & cpuson & (1 << i)) == 0)
+      continue;
+    if(best < 0 || cpus[i].runq.n < cpus[best].runq.n)
+      best = i;
+  }
+  return best < 0 ? 0 : best;
+}
+
+// Mark p RUNNABLE and append it, at its priority level, to the
+// run queue of the CPU it last ran on, which likely still has
+// its cache lines, unless p's affinity no longer allows that
+// CPU. Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  if((p->affinity & (1 << p->cpu)) == 0)
+    p->cpu = pickcpu(p->affinity);
+  rq = &cpus[p->cpu].runq;
+  boostproc(p);
+  p->state = RUNNABLE;
+  p->qtime = ticks;
+  acquire(&rq->lock);
+  rqappend(rq, p, p->prio);
+  rq->n++;
+  release(&rq->lock);
+  // unless p is giving up this CPU, which is about to schedule.
+  if(p != mycpu()->proc || &cpus[p->cpu] != mycpu())
+    kick(&cpus[p->cpu], p->affinity);
+}
+
+// Wake an idle CPU to run a process just queued on c: c
+// itself if it is idle, or else any idle CPU in mask, to
+// steal it. The interrupt comes from setting the CPU's
+// MTIMECMP to 0.
+static void
+kick(struct cpu *c, uint mask)
+{
+  struct cpu *o;
+
+  __sync_synchronize();  // pairs with idle()
+  if(!c->idle){
+    for(o = cpus; o < &cpus[NCPU]; o++)
+      if(o->idle && (mask & (1 << (o - cpus))))
+        break;
+    if(o == &cpus[NCPU])
+      return;
+    c = o;
+  }
+  *(uint64*)CLINT_MTIMECMP(c - cpus) = 0;
+}
+
+// Is some queued process allowed to run on CPU id?
+static int
+canrun(int id)
+{
+  struct cpu *c;
+  struct proc *p;
+  int i, found = 0;
+
+  for(c = cpus; c < &cpus[NCPU] && !found; c++){
+    if(c->runq.n == 0)
+      continue;
+    acquire(&c->runq.lock);
+    for(i = 0; i < NPRIO && !found; i++)
+      for(p = c->runq.head[i]; p && !found; p = p->rqnext)
+        found = (p->affinity & (1 << id)) != 0;
+    release(&c->runq.lock);
+  }
+  return found;
+}
+
+// Wait in wfi for something to run, with the timer set only
+// for the next sleep() deadline, if any. Another CPU that
+// queues a process wakes this one with kick(); it either
+// sees c->idle or this CPU sees its queued process. With
+// interrupts off, an interrupt that arrives before the wfi
+// still ends it, and is taken when the scheduler turns
+// interrupts back on.
+static void
+idle(struct cpu *c)
+{
+  intr_off();
+  timerarm((uint64)timernext() * TICKCYCLES);
+  c->idle = 1;
+  __sync_synchronize();
+  if(!canrun(c - cpus))
+    asm volatile("wfi");
+  c->idle = 0;
+}
+
+// Remove and return the first process on rq's highest
+// non-empty level that may run on CPU id, setting *prio
+// to the level, or return 0 if there is none. p->affinity
+// is read without p->lock; a stale value at worst runs p
+// once more where it used to be allowed.
+static struct proc*
+runqget(struct runq *rq, int id, int *prio)
+{
+  struct proc *p, *prev;
+  int i;
+
+  acquire(&rq->lock);
+  if(rq->boost != curboost())
+    rqboost(rq);
+  for(i = 0; i < NPRIO; i++){
+    prev = 0;
+    for(p = rq->head[i]; p; prev = p, p = p->rqnext)
+      if(p->affinity & (1 << id))
+        break;
+    if(p == 0)
+      continue;
+    rqunlink(rq, i, prev, p);
+    *prio = i;
+    break;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Find work for idle CPU id by taking a process from the
+// longest run queue, or if everything there is pinned to
+// other CPUs, from any queue. Looks at NCPU queues, not
+// at proc[].
+static struct proc*
+steal(int id, int *prio)
+{
+  struct cpu *c, *busiest = 0;
+  struct proc *p;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->runq.n > 0 && (busiest == 0 || c->runq.n > busiest->runq.n))
+      busiest = c;
+  if(busiest == 0)
+    return 0;
+  if((p = runqget(&busiest->runq, id, prio)) != 0)
+    return p;
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c != busiest && c->runq.n > 0 && (p = runqget(&c->runq, id, prio)) != 0)
+      return p;
+  return 0;
+}
+
+// Per-CPU multi-level feedback queue scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the highest-priority process from this CPU's
+//    run queue, or steal one from the busiest other queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+// A process starts at its nice level and moves down a level
+// each time it uses up its quantum there (see schedtick());
+// one that sleeps before then, like an interactive shell,
+// stays where it is.
 void
 scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  int prio;
   
   c->proc = 0;
+  __sync_fetch_and_or(&cpuson, 1 << id);
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
-    
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
-      }
-      release(&p->lock);
+
+    if((p = runqget(&c->runq, id, &prio)) == 0 && (p = steal(id, &prio)) == 0){
+      idle(c);
+      continue;
     }
-    if(found == 0) {
-      intr_on();
-      asm volatile("wfi");
+
+    // p may still be on its way out of another CPU (yield()
+    // queues it before calling sched()); that CPU holds p->lock
+    // until it has switched away, so this waits for it.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: queued proc not runnable");
+
+    // p was boosted while it waited.
+    if(prio < p->prio){
+      p->prio = prio < p->nice ? p->nice : prio;
+      p->slice = 0;
     }
+    p->boost = curboost();
+    p->wticks += ticks - p->qtime;
+    p->nsched++;
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    timerarm(nexttick());
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -523,17 +1075,49 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
 
+// Called on each timer interrupt while the current process
+// is running. Charges the tick to it, moves it down a level
+// once it has used up its quantum, and gives up the CPU if
+// it has, or if a higher-priority process is waiting here.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq = &mycpu()->runq;
+  int i, preempt = 0;
+
+  acquire(&p->lock);
+  p->rticks++;
+  boostproc(p);
+  if(++p->slice >= QUANTUM(p->prio)){
+    p->slice = 0;
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    preempt = 1;
+  }
+  // a racy peek; a miss just waits for the next tick.
+  for(i = 0; i < p->prio; i++)
+    if(rq->head[i])
+      preempt = 1;
+  if(preempt){
+    setrunnable(p);
+    sched();
+  }
+  release(&p->lock);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
 forkret(void)
 {
   static int first = 1;
+  int pid;
 
   // Still holding p->lock from scheduler.
   release(&myproc()->lock);
@@ -543,38 +1127,81 @@ forkret(void)
     // regular process (e.g., because it calls sleep), and thus cannot
     // be run from main().
     first = 0;
-    fsinit(ROOTDEV);
+    ramdiskload();
+    if(fsinit(ROOTDEV) < 0)
+      panic("invalid file system");
+    // the file system's background work, at low priority.
+    if((pid = kthread_create(flusher, 0, "flusher")) < 0)
+      panic("flusher");
+    setpriority(pid, NPRIO-1);
   }
 
   usertrapret();
 }
 
+// Add p to the head of wq. Caller must hold wq->lock.
+static void
+wqinsert(struct waitq *wq, struct proc *p)
+{
+  p->wq = wq;
+  p->wqseq = ++wq->seq;
+  p->wqprev = 0;
+  p->wqnext = wq->head;
+  if(wq->head)
+    wq->head->wqprev = p;
+  wq->head = p;
+}
+
+// Take p off wq. Caller must hold wq->lock.
+static void
+wqremove(struct waitq *wq, struct proc *p)
+{
+  if(p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    wq->head = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  p->wq = 0;
+  p->wqnext = p->wqprev = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = &waitq[WQHASH(chan)];
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once p is on chan's wait queue, a wakeup
+  // is guaranteed to find it, and it can't
+  // make p runnable before sched() has
+  // switched away (wakeup locks p->lock),
   // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
+  if(lk != &p->lock)  //DOC: sleeplock0
     acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&wq->lock);
+  p->chan = chan;
+  wqinsert(wq, p);
+  release(&wq->lock);
+  if(lk != &p->lock)
     release(lk);
-  }
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
 
   sched();
 
-  // Tidy up.
+  // Tidy up. p is still on the wait queue if
+  // something other than wakeup() woke it.
+  acquire(&wq->lock);
+  if(p->wq)
+    wqremove(wq, p);
   p->chan = 0;
+  release(&wq->lock);
 
   // Reacquire original lock.
   if(lk != &p->lock){
@@ -588,15 +1215,59 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  wakeupn(chan, -1);
+}
+
+// Wake up at most n processes sleeping on chan, or all of
+// them if n < 0, and return the number woken.
+// Must be called without any p->lock.
+// Looks only at chan's wait queue. Each waiter is taken off
+// the queue before its p->lock is acquired, since sleep()
+// locks the queue while holding p->lock; if p has meanwhile
+// been woken some other way and gone back to sleep, it just
+// gets a spurious wakeup. Processes that went to sleep after
+// wakeupn() started are left alone, so that it finishes.
+int
+wakeupn(void *chan, int n)
+{
+  struct waitq *wq = &waitq[WQHASH(chan)];
   struct proc *p;
+  uint seq;
+  int woken = 0;
+
+  acquire(&wq->lock);
+  seq = wq->seq;
+  release(&wq->lock);
+  while(n < 0 || woken < n){
+    acquire(&wq->lock);
+    for(p = wq->head; p; p = p->wqnext)
+      if(p->chan == chan && (int)(seq - p->wqseq) >= 0)
+        break;
+    if(p)
+      wqremove(wq, p);
+    release(&wq->lock);
+    if(p == 0)
+      break;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
     acquire(&p->lock);
-    if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+    if(p->state == SLEEPING && p->chan == chan){
+      setrunnable(p);
+      woken++;
     }
     release(&p->lock);
   }
+  return woken;
+}
+
+// Wake up p if it is sleeping on chan, leaving any others
+// there. Must be called without any p->lock.
+void
+wakeproc(struct proc *p, void *chan)
+{
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan)
+    setrunnable(p);
+  release(&p->lock);
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -607,7 +1278,7 @@ wakeup1(struct proc *p)
   if(!holding(&p->lock))
     panic("wakeup1");
   if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+    setrunnable(p);
   }
 }
 
@@ -625,9 +1296,76 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
+      }
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Set the nice level of process pid, clamped to 0..NPRIO-1.
+// The process never runs at a higher priority (lower level)
+// than its nice level. Returns 0, or -1 if there is no such
+// process.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < 0)
+    nice = 0;
+  if(nice > NPRIO-1)
+    nice = NPRIO-1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->nice = nice;
+      if(p->prio < nice)
+        p->prio = nice;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Let process pid (0 for the caller) run only on the CPUs
+// whose bits are set in mask. Returns 0, or -1 if there is
+// no such process or mask has no running CPU. A caller that
+// has excluded its own CPU moves off it at once.
+int
+setaffinity(int pid, uint mask)
+{
+  struct proc *p, *me = myproc();
+  struct runq *rq;
+  int queued;
+
+  if(pid == 0)
+    pid = me->pid;
+  mask &= cpuson;
+  if(mask == 0)
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->affinity = mask;
+      if(p->state == RUNNABLE && (mask & (1 << p->cpu)) == 0){
+        // queued where it may not run now; the CPUs it may
+        // run on would only find it there by stealing.
+        rq = &cpus[p->cpu].runq;
+        acquire(&rq->lock);
+        queued = rqremove(rq, p);
+        release(&rq->lock);
+        if(queued)
+          setrunnable(p);  // on a CPU in mask
       }
       release(&p->lock);
+      if(p == me && (mask & (1 << me->cpu)) == 0)
+        yield();
       return 0;
     }
     release(&p->lock);
@@ -635,6 +1373,28 @@ kill(int pid)
   return -1;
 }
 
+// Return the affinity mask of process pid (0 for the
+// caller), or -1 if there is no such process.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      mask = p->affinity & cpuson;
+      release(&p->lock);
+      return mask;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
@@ -690,6 +1450,9 @@ procdump(void)
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    printf(" cpu %d aff %x prio %d nice %d run %d wait %d sched %d",
+           p->cpu, p->affinity & cpuson, p->prio, p->nice, p->rticks,
+           p->wticks, p->nsched);
     printf("\n");
   }
 }
@@ -18,12 +18,26 @@ struct context {
   uint64 s11;
 };
 
+// A CPU's queues of RUNNABLE processes, one per priority
+// level, linked through p->rqnext.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;                      // Total length; read without the lock by stealers.
+  uint boost;                 // Last priority boost applied to the queues
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct runq runq;           // Processes waiting to run here.
+  uint64 timer;               // mtime of the timer interrupt asked for, or ~0.
+  int idle;                   // Waiting in wfi with nothing to run?
+  uint tick;                  // ticks at this CPU's last clock interrupt.
 };
 
 extern struct cpu cpus[NCPU];
@@ -85,22 +99,56 @@ enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 // Per-process state
 struct proc {
   struct spinlock lock;
+  struct spinlock memlock;     // Serializes changes to a shared page table
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
   struct proc *parent;         // Parent process
+  struct proc *leader;         // Process p is a thread of, or 0
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p goes on
+  uint affinity;               // Bit i set if p may run on CPU i
+  int prio;                    // Current priority level, nice..NPRIO-1
+  int nice;                    // Highest priority level p may have
+  int slice;                   // Ticks used at this level
+  uint boost;                  // Last priority boost applied to p
+  uint qtime;                  // When p was last queued
+  uint rticks;                 // Ticks spent running
+  uint wticks;                 // Ticks spent waiting on a run queue
+  uint nsched;                 // Times scheduled
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next on the run queue
+
+  // the wait queue's lock must be held when using these:
+  struct waitq *wq;            // Wait queue p is on, or 0
+  struct proc *wqnext;         // Next and previous on the wait queue
+  struct proc *wqprev;
+  uint wqseq;                  // When p joined the wait queue
+
+  // tickslock must be held when using these:
+  uint deadline;               // Tick at which timersleep() wakes p
+  uint64 hrdeadline;           // mtime at which timersleephr() wakes p
+  struct proc **tslot;         // Timer wheel slot p is on, or 0
+  void *tchan;                 // Channel the timer wakes p from
+  struct spinlock *tlock;      // Lock the timer holds to wake p, or 0
+  struct proc *tnext;          // Next and previous in the slot
+  struct proc *tprev;
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 trapva;               // where trapframe is mapped in pagetable
+  struct vdso *vdso;           // data page user code reads at VDSO
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  void (*kfn)(void*);          // Kernel thread's function, and its argument
+  void *karg;
   char name[16];               // Process name (debugging)
 };
@@ -1,45 +1,95 @@
 //
-// ramdisk that uses the disk image loaded by qemu -initrd fs.img
+// ramdisk: block device RAMDEV, RAMDISKSIZE BSIZE-blocks of
+// kalloc()ed memory. At boot it is loaded with a copy of the
+// file system on the virtio disk (fs.img), so that it can be
+// mounted, or be the root file system (RAMROOT), without any
+// disk latency. Writes are lost at reboot.
 //
 
 #include "types.h"
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
-#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
+#define RAMDISKBYTES ((uint64)RAMDISKSIZE * BSIZE)
+#define NRAMPAGE     ((RAMDISKBYTES + PGSIZE - 1) / PGSIZE)
+
+static char *ramdisk[NRAMPAGE + 1];  // the ramdisk's pages
+
 void
 ramdiskinit(void)
 {
+  int i;
+
+  if(RAMDISKSIZE == 0)
+    return;
+  for(i = 0; i < NRAMPAGE; i++){
+    if((ramdisk[i] = kalloc()) == 0)
+      panic("ramdiskinit: out of memory");
+    memset(ramdisk[i], 0, PGSIZE);
+  }
+  bdevsw[RAMDEV].rw = ramdiskrw;
+}
+
+// Copy n bytes between the ramdisk at off and p.
+static void
+ramcopy(uint64 off, char *p, uint n, int write)
+{
+  uint m;
+
+  for(; n > 0; n -= m, off += m, p += m){
+    m = PGSIZE - off % PGSIZE;
+    if(m > n)
+      m = n;
+    if(write)
+      memmove(ramdisk[off / PGSIZE] + off % PGSIZE, p, m);
+    else
+      memmove(p, ramdisk[off / PGSIZE] + off % PGSIZE, m);
+  }
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Read or write b, which must be locked.
 void
-ramdiskrw(struct buf *b)
+ramdiskrw(struct buf *b, int write)
 {
+  uint64 off = (uint64)b->blockno * b->size;
+
   if(!holdingsleep(&b->lock))
     panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
-
-  if(b->blockno >= FSSIZE)
+  if(off + b->size > RAMDISKBYTES)
     panic("ramdiskrw: blockno too big");
 
-  uint64 diskaddr = b->blockno * BSIZE;
-  char *addr = (char *)RAMDISK + diskaddr;
-
-  if(b->flags & B_DIRTY){
-    // write
-    memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
-  } else {
-    // read
-    memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
+  ramcopy(off, (char*)b->data, b->size, write);
+}
+
+// Copy the file system on the virtio disk into the ramdisk.
+// Must be called from a process, before either is in use.
+void
+ramdiskload(void)
+{
+  struct buf *bp;
+  struct superblock sb;
+  uint64 bytes, off;
+
+  if(RAMDISKSIZE == 0)
+    return;
+  bp = bread(VIRTIODEV, SBOFF / BSIZE);
+  memmove(&sb, bp->data + SBOFF % BSIZE, sizeof(sb));
+  brelse(bp);
+  if(sb.magic != FSMAGIC)
+    panic("ramdiskload: no file system");
+  bytes = (uint64)sb.size * sb.bsize;
+  if(bytes > RAMDISKBYTES)
+    panic("ramdiskload: ramdisk too small");
+
+  for(off = 0; off < bytes; off += BSIZE){
+    bp = bread(VIRTIODEV, off / BSIZE);
+    ramcopy(off, (char*)bp->data, BSIZE, 1);
+    brelse(bp);
   }
+  printf("ramdisk: loaded %d blocks\n", (int)(bytes / BSIZE));
 }
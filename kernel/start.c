@@ -41,6 +41,11 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let supervisor and user mode read the time CSR,
+  // for the vDSO (see vdso.h).
+  w_mcounteren(r_mcounteren() | 2);
+  w_scounteren(r_scounteren() | 2);
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -59,17 +64,16 @@ timerinit()
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  // ask the CLINT for the first timer interrupt. after that,
+  // the kernel asks for each one by writing MTIMECMP itself
+  // (see timerarm() in trap.c), only when it needs one.
+  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + TICKCYCLES;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..3] : space for timervec to save registers.
   // scratch[4] : address of CLINT MTIMECMP register.
-  // scratch[5] : desired interval (in cycles) between timer interrupts.
   uint64 *scratch = &mscratch0[32 * id];
   scratch[4] = CLINT_MTIMECMP(id);
-  scratch[5] = interval;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
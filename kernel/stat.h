@@ -9,3 +9,17 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// File system statistics, filled in by statfs().
+struct statfs {
+  int dev;         // File system's device
+  uint bsize;      // Block size (0 if not block based)
+  uint blocks;     // Data blocks
+  uint bfree;      // Free data blocks
+  uint files;      // Inodes
+  uint ffree;      // Free inodes
+  uint fextents;   // Runs of contiguous free blocks
+  uint fmaxrun;    // Blocks in the longest run
+  uint frag;       // Free space fragmentation, 0-100:
+                   // 100 - 100*fmaxrun/bfree
+};
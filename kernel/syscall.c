@@ -104,6 +104,28 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_mount(void);
+extern uint64 sys_umount(void);
+extern uint64 sys_statfs(void);
+extern uint64 sys_readblock(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_nice(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_clock_gettime(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_sched_setaffinity(void);
+extern uint64 sys_sched_getaffinity(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,6 +149,28 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_sendfile] sys_sendfile,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_mount]   sys_mount,
+[SYS_umount]  sys_umount,
+[SYS_statfs]  sys_statfs,
+[SYS_readblock] sys_readblock,
+[SYS_fallocate] sys_fallocate,
+[SYS_nice]    sys_nice,
+[SYS_setpriority] sys_setpriority,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_sched_getaffinity] sys_sched_getaffinity,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
 };
 
 void
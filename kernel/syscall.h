@@ -20,3 +20,25 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_pread  22
+#define SYS_pwrite 23
+#define SYS_readv  24
+#define SYS_writev 25
+#define SYS_sendfile 26
+#define SYS_fsync  27
+#define SYS_fdatasync 28
+#define SYS_mount  29
+#define SYS_umount 30
+#define SYS_statfs 31
+#define SYS_readblock 32
+#define SYS_fallocate 33
+#define SYS_nice   34
+#define SYS_setpriority 35
+#define SYS_clock_gettime 36
+#define SYS_nanosleep 37
+#define SYS_sched_setaffinity 38
+#define SYS_sched_getaffinity 39
+#define SYS_clone  40
+#define SYS_join   41
+#define SYS_futex_wait 42
+#define SYS_futex_wake 43
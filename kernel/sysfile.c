@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -91,6 +92,191 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Read at an explicit offset, leaving the file offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+// Write at an explicit offset, leaving the file offset alone.
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Fetch the nth and n+1th system call arguments as a user
+// array of iovecs and its length, and copy the array into iov,
+// which must have room for IOV_MAX entries.
+// Returns the number of entries, or -1 if the array is bad.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 uiov, tot;
+  int i, iovcnt;
+
+  if(argaddr(n, &uiov) < 0 || argint(n+1, &iovcnt) < 0)
+    return -1;
+  if(iovcnt < 0 || iovcnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, iovcnt*sizeof(*iov)) < 0)
+    return -1;
+  // the total is returned as an int.
+  tot = 0;
+  for(i = 0; i < iovcnt; i++){
+    if(iov[i].iov_len > 0x7fffffff || (tot += iov[i].iov_len) > 0x7fffffff)
+      return -1;
+  }
+  return iovcnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int iovcnt;
+
+  if(argfd(0, 0, &f) < 0 || (iovcnt = argiov(1, iov)) < 0)
+    return -1;
+  return filereadv(f, iov, iovcnt);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int iovcnt;
+
+  if(argfd(0, 0, &f) < 0 || (iovcnt = argiov(1, iov)) < 0)
+    return -1;
+  return filewritev(f, iov, iovcnt);
+}
+
+// Move up to n bytes from file infd to outfd (a pipe or
+// another file) inside the kernel.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesend(out, in, n);
+}
+
+// Mount the file system on device dev on directory path.
+uint64
+sys_mount(void)
+{
+  char path[MAXPATH];
+  int dev;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &dev) < 0)
+    return -1;
+  return mount(path, dev);
+}
+
+uint64
+sys_umount(void)
+{
+  char path[MAXPATH];
+
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return umount(path);
+}
+
+// Allocate blocks for bytes [off, off+len) of a file.
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0)
+    return -1;
+  if(off < 0 || len <= 0)
+    return -1;
+  return fileprealloc(f, off, len);
+}
+
+// Statistics for the file system that holds path.
+uint64
+sys_statfs(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  struct statfs st;
+  uint64 addr;
+  uint dev;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  dev = ip->dev;
+  iput(ip);
+  end_op();
+
+  fsstat(dev, &st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Read a raw block of a disk file system, for fsck.
+uint64
+sys_readblock(void)
+{
+  int dev, bn;
+  uint64 addr;
+
+  if(argint(0, &dev) < 0 || argint(1, &bn) < 0 || argaddr(2, &addr) < 0)
+    return -1;
+  return fsreadblock(dev, bn, addr);
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f, 0);
+}
+
+uint64
+sys_fdatasync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f, 1);
+}
+
 uint64
 sys_close(void)
 {
@@ -210,7 +396,7 @@ sys_unlink(void)
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ip->type == T_DIR && (!isdirempty(ip) || ismounted(ip))){
     iunlockput(ip);
     goto bad;
   }
@@ -258,7 +444,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -336,6 +522,8 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    // only for files in disk blocks.
+    f->direct = (omode & O_DIRECT) && ip->type == T_FILE && fsbsize(ip->dev) != 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "time.h"
 
 uint64
 sys_exit(void)
@@ -41,15 +42,32 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  return growproc(n);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
     return -1;
-  return addr;
+  return join(tid, p);
 }
 
 uint64
@@ -61,13 +79,14 @@ sys_sleep(void)
   if(argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
+  tickupdate();
   ticks0 = ticks;
   while(ticks - ticks0 < n){
     if(myproc()->killed){
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    timersleep(ticks0 + n);
   }
   release(&tickslock);
   return 0;
@@ -91,7 +110,158 @@ sys_uptime(void)
   uint xticks;
 
   acquire(&tickslock);
+  tickupdate();
   xticks = ticks;
   release(&tickslock);
   return xticks;
 }
+
+// add n to the caller's nice level and return the new level.
+uint64
+sys_nice(void)
+{
+  int n;
+  struct proc *p = myproc();
+
+  if(argint(0, &n) < 0)
+    return -1;
+  setpriority(p->pid, p->nice + n);
+  return p->nice;
+}
+
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  if(argint(0, &pid) < 0 || argint(1, &nice) < 0)
+    return -1;
+  return setpriority(pid, nice);
+}
+
+uint64
+sys_sched_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_sched_getaffinity(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getaffinity(pid);
+}
+
+#define NSPERCYCLE (1000000000 / MTIMEHZ)
+#define MAXSLEEP   (365*24*60*60ULL)  // longest timed sleep, in seconds
+
+// Read a struct timespec from user address addr, and set
+// *when to the mtime at which that much time from now will
+// have passed. A time longer than MAXSLEEP is cut to it, so
+// that *when can't wrap around, and stays within what the
+// timer wheel's tick arithmetic handles.
+static int
+argdeadline(uint64 addr, uint64 *when)
+{
+  struct timespec ts;
+
+  if(copyin(myproc()->pagetable, (char*)&ts, addr, sizeof(ts)) < 0)
+    return -1;
+  if(ts.tv_nsec >= 1000000000)
+    return -1;
+  if(ts.tv_sec >= MAXSLEEP){
+    ts.tv_sec = MAXSLEEP;
+    ts.tv_nsec = 0;
+  }
+  *when = mtime() + ts.tv_sec * MTIMEHZ + (ts.tv_nsec + NSPERCYCLE - 1) / NSPERCYCLE;
+  return 0;
+}
+
+// return the time since boot in nanoseconds, to the
+// resolution of the CLINT's clock.
+uint64
+sys_clock_gettime(void)
+{
+  int clock;
+  uint64 addr, ns;
+  struct timespec ts;
+
+  if(argint(0, &clock) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  if(clock != CLOCK_MONOTONIC)
+    return -1;
+  ns = mtime() * NSPERCYCLE;
+  ts.tv_sec = ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  if(copyout(myproc()->pagetable, addr, (char*)&ts, sizeof(ts)) < 0)
+    return -1;
+  return 0;
+}
+
+// sleep for the time in *req, to within a few CLINT cycles
+// rather than a tick. if killed, return -1 with the time
+// left in *rem, when rem isn't 0.
+uint64
+sys_nanosleep(void)
+{
+  uint64 req, rem, when, now, ns;
+  struct timespec ts;
+  struct proc *p = myproc();
+
+  if(argaddr(0, &req) < 0 || argaddr(1, &rem) < 0)
+    return -1;
+  if(argdeadline(req, &when) < 0)
+    return -1;
+
+  acquire(&tickslock);
+  tickupdate();
+  while((now = mtime()) < when){
+    if(p->killed){
+      release(&tickslock);
+      if(rem){
+        ns = (when - now) * NSPERCYCLE;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        copyout(p->pagetable, rem, (char*)&ts, sizeof(ts));
+      }
+      return -1;
+    }
+    timersleephr(when);
+  }
+  release(&tickslock);
+  return 0;
+}
+
+// wait on the futex at addr if it holds val, for at most
+// the time in *timeout, unless timeout is 0.
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr, timeout, when;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0 || argaddr(2, &timeout) < 0)
+    return -1;
+  when = 0;
+  if(timeout && argdeadline(timeout, &when) < 0)
+    return -1;
+  return futexwait(addr, val, when);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
@@ -0,0 +1,9 @@
+// Clocks for clock_gettime() and nanosleep().
+// Both the kernel and user programs use this header file.
+
+#define CLOCK_MONOTONIC 1  // time since boot; the only clock
+
+struct timespec {
+  uint64 tv_sec;   // seconds
+  uint64 tv_nsec;  // nanoseconds, less than 1000000000
+};
@@ -0,0 +1,286 @@
+// Timer wheel for sleep().
+//
+// A process sleeping for some number of ticks goes on a slot of
+// a hierarchical timer wheel, picked by its deadline, and sleeps
+// on a channel of its own. The clock interrupt then wakes just the
+// processes whose deadlines have come, once each, rather than
+// every sleeper on every tick. Level 0 has a slot for each of the
+// next WHEELSIZE ticks, and each level above has a slot for each
+// WHEELSIZE slots of the level below; when the ticks reach the
+// start of a slot above level 0, its processes are cascaded down
+// to the slots below. A sleep that ends less than a tick from
+// now, the last part of a nanosleep(), waits instead on a short
+// list sorted by mtime deadline, and some CPU keeps its timer
+// set for the first of those. tickslock protects both.
+//
+// timerset() puts a process on the same wheel to bound some
+// other sleep, such as a futex wait: when its time comes, the
+// process is woken from that sleep's channel.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define WHEELBITS 6
+#define WHEELSIZE (1 << WHEELBITS)
+#define NLEVEL    4
+#define SPAN(l)   (1U << (WHEELBITS*(l)))  // ticks per slot on level l
+#define MAXDELTA  (SPAN(NLEVEL) - 1)       // furthest ahead a slot can be
+
+static struct proc *wheel[NLEVEL][WHEELSIZE];
+static uint wheelnow;  // the last tick the wheel has been run for
+static struct proc *hrlist;  // sub-tick sleepers, by hrdeadline
+
+// Put p on the slot for p->deadline. A deadline too far
+// ahead for the wheel goes on the furthest slot, and is
+// placed again when that slot is cascaded.
+static void
+tadd(struct proc *p)
+{
+  uint when = p->deadline;
+  uint delta = when - wheelnow;
+  struct proc **slot;
+  int l;
+
+  if(delta > MAXDELTA){
+    delta = MAXDELTA;
+    when = wheelnow + MAXDELTA;
+  }
+  for(l = 0; l < NLEVEL-1; l++)
+    if(delta < SPAN(l+1))
+      break;
+  slot = &wheel[l][(when / SPAN(l)) % WHEELSIZE];
+
+  p->tslot = slot;
+  p->tprev = 0;
+  p->tnext = *slot;
+  if(*slot)
+    (*slot)->tprev = p;
+  *slot = p;
+}
+
+// Put p on hrlist, in order of p->hrdeadline.
+static void
+hradd(struct proc *p)
+{
+  struct proc **pp, *prev = 0;
+
+  for(pp = &hrlist; *pp && (*pp)->hrdeadline <= p->hrdeadline; pp = &(*pp)->tnext)
+    prev = *pp;
+  p->tslot = &hrlist;
+  p->tprev = prev;
+  p->tnext = *pp;
+  if(*pp)
+    (*pp)->tprev = p;
+  *pp = p;
+}
+
+// Take p off its slot, or off hrlist.
+static void
+tdel(struct proc *p)
+{
+  if(p->tprev)
+    p->tprev->tnext = p->tnext;
+  else
+    *p->tslot = p->tnext;
+  if(p->tnext)
+    p->tnext->tprev = p->tprev;
+  p->tslot = 0;
+  p->tnext = p->tprev = 0;
+}
+
+// p's time has come: wake it, if it is asleep on p->tchan,
+// holding p->tlock so that it can't be between checking
+// timerfired() and going to sleep.
+static void
+texpire(struct proc *p)
+{
+  if(p->tlock)
+    acquire(p->tlock);
+  wakeproc(p, p->tchan);
+  if(p->tlock)
+    release(p->tlock);
+}
+
+// Empty slot and return the list of processes that were on it.
+static struct proc*
+tslotget(struct proc **slot)
+{
+  struct proc *p, *list = *slot;
+
+  *slot = 0;
+  for(p = list; p; p = p->tnext)
+    p->tslot = 0;
+  return list;
+}
+
+// Sleep until ticks reaches deadline, or until the process is
+// woken some other way, such as by kill(). Caller must hold
+// tickslock, and should check ticks again when this returns.
+void
+timersleep(uint deadline)
+{
+  struct proc *p = myproc();
+
+  if(!holding(&tickslock))
+    panic("timersleep");
+  if((int)(deadline - wheelnow) <= 0)
+    return;
+  p->deadline = deadline;
+  p->tchan = &p->deadline;
+  p->tlock = 0;
+  tadd(p);
+  sleep(&p->deadline, &tickslock);
+  if(p->tslot)
+    tdel(p);
+}
+
+// Sleep until mtime() reaches when, or until the process is
+// woken some other way. Whole ticks are slept on the wheel,
+// and the rest on hrlist, with this CPU's timer set for it.
+// Caller must hold tickslock, and should check mtime() again
+// when this returns.
+void
+timersleephr(uint64 when)
+{
+  struct proc *p = myproc();
+
+  if(!holding(&tickslock))
+    panic("timersleephr");
+  if(when <= mtime())
+    return;
+  if((int)(when / TICKCYCLES - wheelnow) > 0){
+    timersleep(when / TICKCYCLES);
+    return;
+  }
+  p->hrdeadline = when;
+  p->tchan = &p->deadline;
+  p->tlock = 0;
+  hradd(p);
+  timerarm(when);
+  sleep(&p->deadline, &tickslock);
+  if(p->tslot)
+    tdel(p);
+}
+
+// Set a timer for the current process, so that when mtime()
+// reaches when, it is woken if it is asleep on chan. The timer
+// holds lk, if it is not 0, to wake the process; a caller that
+// checks timerfired() holding lk, and then sleeps on chan with
+// lk, can't miss the wakeup. Whole ticks are timed on the wheel,
+// so the wakeup may come up to a tick early; the caller should
+// check mtime() again, and set the timer again if need be.
+// Must be followed by timercancel().
+void
+timerset(uint64 when, void *chan, struct spinlock *lk)
+{
+  struct proc *p = myproc();
+
+  acquire(&tickslock);
+  tickupdate();
+  p->tchan = chan;
+  p->tlock = lk;
+  if((int)(when / TICKCYCLES - wheelnow) > 0){
+    p->deadline = when / TICKCYCLES;
+    tadd(p);
+  } else if(when > mtime()){
+    p->hrdeadline = when;
+    hradd(p);
+    timerarm(when);
+  }
+  release(&tickslock);
+}
+
+// Has the current process's timer fired? The timer takes p off
+// its list before taking p->tlock, so once the caller holds
+// that lock, the answer can only change from no to yes by way
+// of a wakeup that the caller will see.
+int
+timerfired(void)
+{
+  return myproc()->tslot == 0;
+}
+
+// Take the current process's timer off, if it hasn't fired.
+void
+timercancel(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&tickslock);
+  if(p->tslot)
+    tdel(p);
+  release(&tickslock);
+}
+
+// Return the next tick at which timertick() has something to
+// do, a wakeup or a cascade, for an idle CPU to ask for a
+// timer interrupt at. Looks at every slot, but only when a
+// CPU is about to go idle.
+uint
+timernext(void)
+{
+  uint t, next;
+  int l, i;
+
+  acquire(&tickslock);
+  next = wheelnow + MAXDELTA;
+  for(l = 0; l < NLEVEL; l++){
+    for(i = 1; i <= WHEELSIZE; i++){
+      t = (wheelnow / SPAN(l) + i) * SPAN(l);
+      if(wheel[l][(t / SPAN(l)) % WHEELSIZE]){
+        if(t - wheelnow < next - wheelnow)
+          next = t;
+        break;
+      }
+    }
+  }
+  release(&tickslock);
+  return next;
+}
+
+// Run the wheel up to the current ticks, cascading the upper
+// slots whose time has come and waking the processes on each
+// tick's level 0 slot, then wake the sub-tick sleepers that
+// are due. Called by tickupdate() holding tickslock.
+void
+timertick(void)
+{
+  struct proc *p, *next;
+  int l;
+
+  while(wheelnow != ticks){
+    wheelnow++;
+
+    // find the highest level with a slot starting now,
+    // and cascade from there down.
+    for(l = 1; l < NLEVEL && wheelnow % SPAN(l) == 0; l++)
+      ;
+    while(--l > 0){
+      p = tslotget(&wheel[l][(wheelnow / SPAN(l)) % WHEELSIZE]);
+      for(; p; p = next){
+        next = p->tnext;
+        tadd(p);
+      }
+    }
+
+    p = tslotget(&wheel[0][wheelnow % WHEELSIZE]);
+    for(; p; p = next){
+      next = p->tnext;
+      texpire(p);
+    }
+  }
+
+  // whichever CPU gets here keeps its timer set for the
+  // next sub-tick sleeper.
+  while((p = hrlist) != 0 && p->hrdeadline <= mtime()){
+    tdel(p);
+    texpire(p);
+  }
+  if(hrlist)
+    timerarm(hrlist->hrdeadline);
+}
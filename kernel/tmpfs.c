@@ -0,0 +1,250 @@
+// In-memory file system, usually mounted on /tmp.
+//
+// Files live in kalloc()ed pages and are gone at reboot. A tnode
+// holds what the disk file system keeps in a dinode, plus a page
+// of pointers to the file's data pages. The inode cache and the
+// directory and path name code in fs.c treat tmpfs inodes like
+// any others, calling the functions here through tmpfsops for
+// anything that touches storage. Nothing is logged, so there is
+// nothing for a transaction to commit.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NTNODE   200                      // tmpfs inodes
+#define NTPAGE   (PGSIZE / sizeof(char*)) // data pages per file
+#define TMAXFILE (NTPAGE * PGSIZE)        // bytes per file
+
+struct tnode {
+  short type;     // 0 if free
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char **pages;   // page of data page pointers, or 0
+};
+
+struct {
+  struct spinlock lock;  // protects tnode allocation
+  struct tnode tnode[NTNODE];
+} tmpfs;
+
+// Write n bytes from src to tp at off, allocating pages
+// as needed. Returns n, or -1 if out of memory or src is
+// bad, after keeping whatever was written.
+static int
+tnwrite(struct tnode *tp, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m;
+  char **pp;
+
+  if(tp->pages == 0){
+    if((tp->pages = (char**)kalloc()) == 0)
+      return -1;
+    memset(tp->pages, 0, PGSIZE);
+  }
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    pp = &tp->pages[off/PGSIZE];
+    if(*pp == 0 && (*pp = kalloc()) == 0)
+      break;
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(either_copyin(*pp + off%PGSIZE, user_src, src, m) == -1)
+      break;
+  }
+  if(off > tp->size)
+    tp->size = off;
+  return tot < n ? -1 : tot;
+}
+
+// Free all of tp's pages.
+static void
+tnfree(struct tnode *tp)
+{
+  int i;
+
+  if(tp->pages == 0)
+    return;
+  for(i = 0; i < NTPAGE; i++){
+    if(tp->pages[i])
+      kfree(tp->pages[i]);
+  }
+  kfree((char*)tp->pages);
+  tp->pages = 0;
+}
+
+static struct inode*
+tmp_ialloc(uint dev, short type, uint near)
+{
+  struct tnode *tp;
+
+  acquire(&tmpfs.lock);
+  for(tp = &tmpfs.tnode[1]; tp < &tmpfs.tnode[NTNODE]; tp++){
+    if(tp->type == 0){
+      memset(tp, 0, sizeof(*tp));
+      tp->type = type;
+      release(&tmpfs.lock);
+      return iget(dev, tp - tmpfs.tnode);
+    }
+  }
+  panic("tmp_ialloc: no inodes");
+}
+
+static void
+tmp_iread(struct inode *ip)
+{
+  struct tnode *tp = &tmpfs.tnode[ip->inum];
+
+  ip->type = tp->type;
+  ip->major = tp->major;
+  ip->minor = tp->minor;
+  ip->nlink = tp->nlink;
+  ip->size = tp->size;
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->synctid = ip->datatid = 0;  // there is no log
+}
+
+// ip->type only changes in tmp_ialloc() and tmp_ifree().
+static void
+tmp_iupdate(struct inode *ip)
+{
+  struct tnode *tp = &tmpfs.tnode[ip->inum];
+
+  tp->major = ip->major;
+  tp->minor = ip->minor;
+  tp->nlink = ip->nlink;
+  tp->size = ip->size;
+}
+
+static void
+tmp_itrunc(struct inode *ip)
+{
+  tnfree(&tmpfs.tnode[ip->inum]);
+  ip->size = 0;
+  tmp_iupdate(ip);
+}
+
+static void
+tmp_ifree(struct inode *ip)
+{
+  tmp_itrunc(ip);
+  ip->type = 0;
+  acquire(&tmpfs.lock);
+  tmpfs.tnode[ip->inum].type = 0;
+  release(&tmpfs.lock);
+}
+
+static int
+tmp_readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  struct tnode *tp = &tmpfs.tnode[ip->inum];
+  uint tot, m;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(either_copyout(user_dst, dst, tp->pages[off/PGSIZE] + off%PGSIZE, m) == -1)
+      break;
+  }
+  return tot;
+}
+
+static int
+tmp_writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  struct tnode *tp = &tmpfs.tnode[ip->inum];
+  int r;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > TMAXFILE)
+    return -1;
+
+  r = tnwrite(tp, user_src, src, off, n);
+  ip->size = tp->size;
+  return r;
+}
+
+static uint
+tmp_bsize(uint dev)
+{
+  return 0;
+}
+
+// tmpfs has no blocks of its own; count pages in use
+// and the free kernel pages it could still grow into.
+static void
+tmp_statfs(uint dev, struct statfs *st)
+{
+  struct tnode *tp;
+  int i;
+
+  st->bsize = PGSIZE;
+  st->bfree = kfreepages();
+  st->blocks = st->bfree;
+  st->files = NTNODE - 1;
+  st->ffree = 0;
+  acquire(&tmpfs.lock);
+  for(tp = &tmpfs.tnode[1]; tp < &tmpfs.tnode[NTNODE]; tp++){
+    if(tp->type == 0){
+      st->ffree++;
+      continue;
+    }
+    if(tp->pages == 0)
+      continue;
+    st->blocks++;
+    for(i = 0; i < NTPAGE; i++)
+      if(tp->pages[i])
+        st->blocks++;
+  }
+  release(&tmpfs.lock);
+  st->fextents = st->fmaxrun = 0;  // pages don't fragment
+}
+
+struct fsops tmpfsops = {
+  .ialloc = tmp_ialloc,
+  .iread = tmp_iread,
+  .iupdate = tmp_iupdate,
+  .itrunc = tmp_itrunc,
+  .ifree = tmp_ifree,
+  .readi = tmp_readi,
+  .writei = tmp_writei,
+  .ibread = 0,
+  .bsize = tmp_bsize,
+  .statfs = tmp_statfs,
+  .prealloc = 0,
+};
+
+// Make an empty root directory and register tmpfs as
+// device TMPDEV, ready for mount().
+void
+tmpfsinit(void)
+{
+  struct tnode *tp = &tmpfs.tnode[ROOTINO];
+  struct dirent de;
+
+  initlock(&tmpfs.lock, "tmpfs");
+  tp->type = T_DIR;
+  tp->nlink = 1;
+  // ".." at the root is taken care of by namex().
+  de.inum = ROOTINO;
+  strncpy(de.name, ".", DIRSIZ);
+  tnwrite(tp, 0, (uint64)&de, 0, sizeof(de));
+  strncpy(de.name, "..", DIRSIZ);
+  tnwrite(tp, 0, (uint64)&de, sizeof(de), sizeof(de));
+  if(tp->size != 2*sizeof(de))
+    panic("tmpfsinit");
+  fsregister(TMPDEV, &tmpfsops);
+}
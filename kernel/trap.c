@@ -27,6 +27,37 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+  mycpu()->timer = ~0ULL;  // start.c's first interrupt is pending
+}
+
+// CLINT cycles since boot, MTIMEHZ per second.
+uint64
+mtime(void)
+{
+  return *(uint64*)CLINT_MTIME;
+}
+
+// The start of the next clock tick, in mtime cycles.
+uint64
+nexttick(void)
+{
+  return (mtime() / TICKCYCLES + 1) * TICKCYCLES;
+}
+
+// Ask for a timer interrupt on this CPU when mtime reaches
+// when, unless one is already due sooner. There is no
+// periodic tick: a CPU running a process asks for one at
+// each tick, and an idle CPU only for the next sleep()
+// deadline. Interrupts must be off.
+void
+timerarm(uint64 when)
+{
+  struct cpu *c = mycpu();
+
+  if(when < c->timer){
+    c->timer = when;
+    *(uint64*)CLINT_MTIMECMP(cpuid()) = when;
+  }
 }
 
 //
@@ -76,9 +107,10 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // on a timer interrupt, let the scheduler decide
+  // whether to give up the CPU.
   if(which_dev == 2)
-    yield();
+    schedtick();
 
   usertrapret();
 }
@@ -125,7 +157,7 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->trapva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -149,29 +181,51 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // maybe give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    schedtick();
 
-  // the yield() may have caused some traps to occur,
+  // the schedtick() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date with the CLINT's clock and run
+// the timer wheel. Caller must hold tickslock. ticks only
+// advances when some CPU takes a timer interrupt, so code
+// that reads it calls this first.
 void
+tickupdate(void)
+{
+  uint t = mtime() / TICKCYCLES;
+
+  if((int)(t - ticks) > 0)
+    ticks = t;
+  timertick();
+}
+
+// Returns 1 if a tick has begun since this CPU's last clock
+// interrupt, 0 for an interrupt asked for within a tick, by
+// nanosleep() or a futex timeout.
+int
 clockintr()
 {
+  struct cpu *c = mycpu();
+  int newtick;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  tickupdate();
+  newtick = c->tick != ticks;
+  c->tick = ticks;
   release(&tickslock);
+  return newtick;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if timer interrupt at a new tick,
+// 1 if other device or timer interrupt within a tick,
 // 0 if not recognized.
 int
 devintr()
@@ -202,17 +256,24 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
-
-    if(cpuid() == 0){
-      clockintr();
-    }
+    // forwarded by timervec in kernelvec.S, which has turned
+    // this CPU's timer off. any CPU may run clockintr().
+    int newtick;
+    mycpu()->timer = ~0ULL;
+    newtick = clockintr();
+
+    // a running process needs the next tick to time its
+    // slice; an idle CPU asks for what it needs in idle().
+    if(mycpu()->proc)
+      timerarm(nexttick());
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    // only a new tick counts against the running process's
+    // time slice.
+    return newtick ? 2 : 1;
   } else {
     return 0;
   }
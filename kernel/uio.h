@@ -0,0 +1,9 @@
+// Scatter/gather buffer for readv() and writev().
+// Both the kernel and user programs use this header file.
+
+#define IOV_MAX 16  // max buffers per readv()/writev()
+
+struct iovec {
+  void *iov_base;  // user buffer
+  uint64 iov_len;  // size of buffer in bytes
+};
@@ -0,0 +1,12 @@
+// The vDSO page: read-only data the kernel maps at VDSO in
+// every process, so that user code can read its pid and the
+// time without a system call. The time comes from the rdtime
+// instruction, which start.c lets user mode execute; ulib's
+// vuptime() and vclock_gettime() scale it with the fields here.
+// Both the kernel and user programs use this header file.
+
+struct vdso {
+  int pid;            // getpid() of the process's first thread
+  uint64 mtimehz;     // rdtime cycles per second
+  uint64 tickcycles;  // rdtime cycles per uptime() tick
+};
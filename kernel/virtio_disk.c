@@ -52,6 +52,7 @@ virtio_disk_init(void)
   uint32 status = 0;
 
   initlock(&disk.vdisk_lock, "virtio_disk");
+  bdevsw[VIRTIODEV].rw = virtio_disk_rw;
 
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 1 ||
@@ -168,7 +169,7 @@ alloc3_desc(int *idx)
 void
 virtio_disk_rw(struct buf *b, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = b->blockno * (b->size / 512);
 
   acquire(&disk.vdisk_lock);
 
@@ -209,7 +210,7 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].next = idx[1];
 
   disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+  disk.desc[idx[1]].len = b->size;
   if(write)
     disk.desc[idx[1]].flags = 0; // device reads b->data
   else
@@ -111,6 +111,24 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// Physical address of user virtual address va, if the n bytes
+// there are in one page that the user may access (and write,
+// if write is set), else 0. For I/O straight to user memory.
+uint64
+walkuser(pagetable_t pagetable, uint64 va, uint n, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA || va % PGSIZE + n > PGSIZE)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  if(write && (*pte & PTE_W) == 0)
+    return 0;
+  return PTE2PA(*pte) + va % PGSIZE;
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <time.h>
 
 #define stat xv6_stat  // avoid clash with host struct stat
 #include "kernel/types.h"
@@ -15,31 +16,39 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 200  // default number of inodes
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
+// [ boot block | sb block | log | inode blocks | inode bit map |
+//                                          free bit map | data blocks ]
+
+int bsize = BSIZE;  // block size (-b)
+int fssize;   // Size of file system in blocks (-size)
+int ninodes = NINODES;  // (-inodes)
+int nbitmap;
+int ninodeblocks;
+int nimap;
 int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, inode map, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;    // the file system image, built in memory
 struct superblock sb;
-char zeroes[BSIZE];
+char zeroes[MAXBSIZE];
 uint freeinode = 1;
 uint freeblock;
 
 
 void balloc(int);
+void imapinit(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void writeimg(void);
 
 // convert to intel byte order
 ushort
@@ -64,20 +73,58 @@ xint(uint x)
   return y;
 }
 
+// Milliseconds since some fixed time.
+double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
+  int i, cc, fd, sbstart;
   uint rootino, inum, off;
   struct dirent de;
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   struct dinode din;
+  double t0, t1;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  while(argc > 1 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-b") == 0 && argc > 2){
+      bsize = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(strcmp(argv[1], "-size") == 0 && argc > 2){
+      fssize = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(strcmp(argv[1], "-inodes") == 0 && argc > 2){
+      ninodes = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else {
+      argc = 0;
+    }
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-b blocksize] [-size blocks] [-inodes n] fs.img files...\n");
+    exit(1);
+  }
+  if(bsize < BSIZE || bsize > MAXBSIZE || bsize % BSIZE != 0){
+    fprintf(stderr, "mkfs: block size must be a multiple of %d up to %d\n",
+            BSIZE, MAXBSIZE);
+    exit(1);
+  }
+  // Directory entries hold 16-bit inode numbers.
+  if(ninodes < 2 || ninodes > 0xffff){
+    fprintf(stderr, "mkfs: bad number of inodes %d\n", ninodes);
     exit(1);
   }
 
@@ -90,30 +137,49 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  // FSSIZE is in default-sized blocks; keep the default image
+  // size the same whatever the block size.
+  t0 = now();
+  sb.bsize = xint(bsize);
+  if(fssize == 0)
+    fssize = FSSIZE * BSIZE / bsize;
+  nbitmap = fssize/(bsize*8) + 1;
+  ninodeblocks = ninodes / IPB(sb) + 1;
+  nimap = ninodes/(bsize*8) + 1;
+
+  // 1 fs block = bsize/512 disk sectors.
+  // The super block is at byte SBOFF, in its own block
+  // if blocks are small enough, else in the boot block.
+  sbstart = SBOFF / bsize + 1;
+  nmeta = sbstart + nlog + ninodeblocks + nimap + nbitmap;
+  nblocks = fssize - nmeta;
+  if(nblocks <= 0){
+    fprintf(stderr, "mkfs: %d blocks is too small\n", fssize);
+    exit(1);
+  }
+  if((img = calloc(fssize, bsize)) == 0){
+    perror("mkfs");
+    exit(1);
+  }
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
-  sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.logstart = xint(sbstart);
+  sb.inodestart = xint(sbstart+nlog);
+  sb.imapstart = xint(sbstart+nlog+ninodeblocks);
+  sb.bmapstart = xint(sbstart+nlog+ninodeblocks+nimap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, inode map blocks %u, bitmap blocks %u) blocks %d total %d of %d bytes\n",
+         nmeta, nlog, ninodeblocks, nimap, nbitmap, nblocks, fssize, bsize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
   memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(buf + SBOFF % bsize, &sb, sizeof(sb));
+  wsect(SBOFF / bsize, buf);
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -163,27 +229,71 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
+  // fix size of root inode dir, unless it fits in the inode
   rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(din.addrs[0] != 0){
+    off = xint(din.size);
+    off = ((off/bsize) + 1) * bsize;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
+  imapinit(freeinode);
 
+  t1 = now();
+  writeimg();
+  printf("mkfs: %d of %d blocks in use, built in %.1f ms, written in %.1f ms\n",
+         freeblock, fssize, t1 - t0, now() - t1);
   exit(0);
 }
 
+// Block sec of the image.
+char*
+blk(uint sec)
+{
+  assert(sec < fssize);
+  return img + (size_t)sec * bsize;
+}
+
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
+  memmove(blk(sec), buf, bsize);
+}
+
+// Write the image out, one write per run of blocks that are
+// not all zero; the zero blocks in between are left as holes.
+void
+writeimg(void)
+{
+  uint b, e;
+  size_t n;
+  ssize_t cc;
+  char *p;
+
+  if(ftruncate(fsfd, (off_t)fssize * bsize) < 0){
+    perror("ftruncate");
     exit(1);
   }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
+  for(b = 0; b < fssize; b = e){
+    if(memcmp(blk(b), zeroes, bsize) == 0){
+      e = b + 1;
+      continue;
+    }
+    for(e = b + 1; e < fssize && memcmp(blk(e), zeroes, bsize) != 0; e++)
+      ;
+    p = blk(b);
+    for(n = (size_t)(e - b) * bsize; n > 0; n -= cc, p += cc){
+      cc = pwrite(fsfd, p, n, p - img);
+      if(cc <= 0){
+        perror("write");
+        exit(1);
+      }
+    }
+  }
+  if(close(fsfd) < 0){
+    perror("close");
     exit(1);
   }
 }
@@ -191,13 +301,13 @@ wsect(uint sec, void *buf)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
   bn = IBLOCK(inum, sb);
   rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)buf) + (inum % IPB(sb));
   *dip = *ip;
   wsect(bn, buf);
 }
@@ -205,27 +315,20 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
   bn = IBLOCK(inum, sb);
   rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)buf) + (inum % IPB(sb));
   *ip = *dip;
 }
 
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
-  }
+  memmove(buf, blk(sec), bsize);
 }
 
 uint
@@ -234,6 +337,7 @@ ialloc(ushort type)
   uint inum = freeinode++;
   struct dinode din;
 
+  assert(inum < ninodes);
   bzero(&din, sizeof(din));
   din.type = xshort(type);
   din.nlink = xshort(1);
@@ -242,20 +346,39 @@ ialloc(ushort type)
   return inum;
 }
 
+// Set bits 0..used-1 of the bit map that starts at block start.
+// The map's blocks are consecutive, so it can be treated as
+// one array.
 void
-balloc(int used)
+setbits(uint start, int used)
 {
-  uchar buf[BSIZE];
+  uchar *map = (uchar*)blk(start);
   int i;
 
+  for(i = 0; i < used / 8; i++)
+    map[i] = 0xff;
+  for(i = used - used % 8; i < used; i++)
+    map[i/8] |= 0x1 << (i%8);
+}
+
+void
+balloc(int used)
+{
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
-  }
+  assert(used <= fssize);
+  setbits(sb.bmapstart, used);
   printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+}
+
+// Mark inodes 0..used-1 allocated in the inode map.
+// Inode 0 is never handed out, so it is marked too.
+void
+imapinit(int used)
+{
+  printf("imapinit: first %d inodes have been allocated\n", used);
+  assert(used <= ninodes);
+  setbits(sb.imapstart, used);
+  printf("imapinit: write inode map block at sector %d\n", sb.imapstart);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -266,16 +389,27 @@ iappend(uint inum, void *xp, int n)
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
+  uint *indirect;
   uint x;
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  // small files keep their data in the inode, as in the kernel.
+  if(din.addrs[0] == 0){
+    if(off + n <= NINLINE){
+      bcopy(p, din.data + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    din.addrs[0] = xint(freeblock++);
+    bcopy(din.data, blk(xint(din.addrs[0])), off);
+    bzero(din.data, sizeof(din.data));
+  }
   while(n > 0){
-    fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
+    fbn = off / bsize;
+    assert(fbn < SB_MAXFILE(sb));
     if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
@@ -285,17 +419,14 @@ iappend(uint inum, void *xp, int n)
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      indirect = (uint*)blk(xint(din.addrs[NDIRECT]));
       if(indirect[fbn - NDIRECT] == 0){
         indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
     }
-    n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    n1 = min(n, (fbn + 1) * bsize - off);
+    bcopy(p, blk(x) + off - (fbn * bsize), n1);
     n -= n1;
     off += n1;
     p += n1;
@@ -0,0 +1,124 @@
+// File system throughput benchmark.
+//
+// Writes, re-reads and removes a file several times and
+// creates a batch of small files, reporting ticks for each
+// phase.  Build fs.img with different block sizes to compare:
+//
+//   make FSBSIZE=1024 clean qemu   then   $ fsbench
+//   make FSBSIZE=4096 clean qemu   then   $ fsbench
+//
+// To separate file system CPU time from disk latency, build with
+// a ramdisk and run it there:
+//
+//   make RAMDISK=2000 clean qemu   then   $ mkdir ram
+//                                         $ mount ram 3
+//                                         $ cd ram; /fsbench
+//
+// A tick is about 1/10th of a second.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define CHUNK 4096
+#define NSMALL 64
+
+char buf[CHUNK];
+
+static void
+report(char *what, int kb, int ticks)
+{
+  if(ticks == 0)
+    ticks = 1;
+  printf("%s: %d KB in %d ticks, %d KB/s\n", what, kb, ticks, kb*10/ticks);
+}
+
+static int
+writefile(char *name, int kb)
+{
+  int fd, i, n;
+
+  fd = open(name, O_CREATE|O_RDWR|O_TRUNC);
+  if(fd < 0){
+    printf("fsbench: cannot create %s\n", name);
+    exit(1);
+  }
+  for(i = 0; i < kb*1024; i += n){
+    n = kb*1024 - i;
+    if(n > CHUNK)
+      n = CHUNK;
+    if(write(fd, buf, n) != n){
+      printf("fsbench: write failed at %d\n", i);
+      exit(1);
+    }
+  }
+  close(fd);
+  return kb;
+}
+
+static int
+readfile(char *name)
+{
+  int fd, n, tot;
+
+  fd = open(name, O_RDONLY);
+  if(fd < 0){
+    printf("fsbench: cannot open %s\n", name);
+    exit(1);
+  }
+  tot = 0;
+  while((n = read(fd, buf, CHUNK)) > 0)
+    tot += n;
+  close(fd);
+  return tot / 1024;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb, rounds, i, t0, wkb, rkb;
+  char name[] = "fsb.00";
+
+  kb = 128;
+  rounds = 4;
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(kb <= 0 || rounds <= 0){
+    fprintf(2, "usage: fsbench [kbytes [rounds]]\n");
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+
+  wkb = rkb = 0;
+  t0 = uptime();
+  for(i = 0; i < rounds; i++){
+    wkb += writefile("fsb.big", kb);
+    unlink("fsb.big");
+  }
+  report("write", wkb, uptime() - t0);
+
+  writefile("fsb.big", kb);
+  t0 = uptime();
+  for(i = 0; i < rounds; i++)
+    rkb += readfile("fsb.big");
+  report("read", rkb, uptime() - t0);
+  unlink("fsb.big");
+
+  t0 = uptime();
+  for(i = 0; i < NSMALL; i++){
+    name[4] = '0' + i/10;
+    name[5] = '0' + i%10;
+    writefile(name, 1);
+  }
+  for(i = 0; i < NSMALL; i++){
+    name[4] = '0' + i/10;
+    name[5] = '0' + i%10;
+    unlink(name);
+  }
+  report("small files", NSMALL, uptime() - t0);
+
+  exit(0);
+}
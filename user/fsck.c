@@ -0,0 +1,317 @@
+// File system consistency checker.
+//
+//   fsck [-j nworker] [path]
+//
+// Reads the disk file system that holds path (default /) with
+// readblock() and checks that every allocated inode has a good
+// type and is marked in the inode map, that each block belongs
+// to at most one file and is marked in the free map exactly when
+// it does, and that each inode's link count matches the directory
+// entries that name it.
+//
+// The inodes are divided among nworker child processes, which
+// scan their share in parallel and send what they found back
+// through a pipe; the parent merges the results and checks the
+// maps.  Files that change during the scan may be reported as
+// errors, so run it on a quiet file system, e.g. at boot.
+//
+// Exits with status 1 if anything was wrong.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NWORKER   3  // default number of workers
+#define MAXWORKER 8
+
+int dev;
+struct superblock sb;
+uint datastart;       // first data block
+int nerr;
+
+// Filled in by each worker for its inodes, or for all of
+// them in the parent once the results are merged.
+uchar *refmap;        // bit per block: used by some file
+ushort *nref;         // directory entries naming each inode
+short *type;          // type of each inode
+short *nlink;         // link count of each inode
+
+uchar buf[MAXBSIZE];
+uchar ibuf[MAXBSIZE];
+uchar ind[MAXBSIZE];
+
+static void
+error(char *fmt, int a, int b, int c)
+{
+  printf("fsck: ");
+  printf(fmt, a, b, c);
+  printf("\n");
+  nerr++;
+}
+
+static void
+rblock(uint bn, uchar *p)
+{
+  if(readblock(dev, bn, p) != sb.bsize){
+    printf("fsck: cannot read block %d\n", bn);
+    exit(1);
+  }
+}
+
+static int
+isset(uchar *map, uint i)
+{
+  return (map[i/8] & (1 << (i%8))) != 0;
+}
+
+static void
+useblock(uint inum, uint bn)
+{
+  if(bn < datastart || bn >= sb.size){
+    error("inode %d: bad block %d", inum, bn, 0);
+    return;
+  }
+  if(isset(refmap, bn))
+    error("block %d used twice (inode %d)", bn, inum, 0);
+  refmap[bn/8] |= 1 << (bn%8);
+}
+
+// Count the entries in directory block p.
+static void
+scandir(uint inum, uchar *p, uint n)
+{
+  struct dirent *de;
+
+  for(de = (struct dirent*)p; (uchar*)(de+1) <= p + n; de++){
+    if(de->inum == 0 || strcmp(de->name, ".") == 0)
+      continue;
+    if(de->inum >= sb.ninodes)
+      error("inode %d: entry for bad inode %d", inum, de->inum, 0);
+    else
+      nref[de->inum]++;
+  }
+}
+
+static void
+scaninode(uint inum, struct dinode *dip)
+{
+  uint nb, k, bn, n;
+  uint *a;
+
+  type[inum] = dip->type;
+  nlink[inum] = dip->nlink;
+  if(dip->type == 0)
+    return;
+  if(dip->type != T_DIR && dip->type != T_FILE && dip->type != T_DEVICE){
+    error("inode %d: bad type %d", inum, dip->type, 0);
+    return;
+  }
+  nb = (dip->size + sb.bsize - 1) / sb.bsize;
+  if(nb > SB_MAXFILE(sb)){
+    error("inode %d: bad size %d", inum, dip->size, 0);
+    return;
+  }
+
+  if(dip->addrs[0] == 0 && dip->size <= NINLINE){
+    nb = 0;  // the data is in the inode
+    if(dip->type == T_DIR)
+      scandir(inum, (uchar*)dip->data, dip->size);
+  }
+
+  a = (uint*)ind;
+  if(dip->addrs[NDIRECT]){
+    useblock(inum, dip->addrs[NDIRECT]);
+    rblock(dip->addrs[NDIRECT], ind);
+  } else
+    memset(ind, 0, sb.bsize);
+  for(k = 0; k < SB_MAXFILE(sb); k++){
+    bn = k < NDIRECT ? dip->addrs[k] : a[k - NDIRECT];
+    if(bn == 0){
+      if(k < nb)
+        error("inode %d: missing block %d", inum, k, 0);
+      continue;
+    }
+    useblock(inum, bn);
+    if(dip->type == T_DIR && k < nb && bn >= datastart && bn < sb.size){
+      n = dip->size - k*sb.bsize;
+      rblock(bn, buf);
+      scandir(inum, buf, n < sb.bsize ? n : sb.bsize);
+    }
+  }
+}
+
+// Scan inodes [lo, hi).
+static void
+scan(uint lo, uint hi)
+{
+  uint inum, bn, lastbn;
+
+  lastbn = 0;
+  for(inum = lo; inum < hi; inum++){
+    bn = IBLOCK(inum, sb);
+    if(bn != lastbn){
+      rblock(bn, ibuf);
+      lastbn = bn;
+    }
+    scaninode(inum, (struct dinode*)ibuf + inum%IPB(sb));
+  }
+}
+
+static void
+readall(int fd, void *p, int n)
+{
+  int m;
+
+  for(; n > 0; n -= m, p = (char*)p + m){
+    if((m = read(fd, p, n)) <= 0){
+      printf("fsck: lost a worker\n");
+      exit(1);
+    }
+  }
+}
+
+// Results, sent from worker to parent.
+#define MAPBYTES (sb.size/8 + 1)
+#define NBYTES   (sb.ninodes * sizeof(short))
+
+static void
+merge(int fd, uint lo, uint hi)
+{
+  static uchar *map;
+  static ushort *ref;
+  uint i;
+  int err;
+
+  if(map == 0){
+    map = malloc(MAPBYTES);
+    ref = malloc(NBYTES);
+  }
+  readall(fd, &err, sizeof(err));
+  readall(fd, map, MAPBYTES);
+  readall(fd, ref, NBYTES);
+  readall(fd, type + lo, (hi - lo) * sizeof(short));
+  readall(fd, nlink + lo, (hi - lo) * sizeof(short));
+  nerr += err;
+  for(i = datastart; i < sb.size; i++){
+    if(isset(map, i) && isset(refmap, i))
+      error("block %d used twice", i, 0, 0);
+  }
+  for(i = 0; i < MAPBYTES; i++)
+    refmap[i] |= map[i];
+  for(i = 0; i < sb.ninodes; i++)
+    nref[i] += ref[i];
+}
+
+// Compare the merged results with the maps.
+static void
+check(void)
+{
+  uint b, i;
+
+  for(b = 0; b < sb.size; b++){
+    if(b % BPB(sb) == 0)
+      rblock(BBLOCK(b, sb), buf);
+    if(b < datastart){
+      if(!isset(buf, b % BPB(sb)))
+        error("meta data block %d marked free", b, 0, 0);
+    } else if(isset(buf, b % BPB(sb)) && !isset(refmap, b))
+      error("block %d marked in use but not in any file", b, 0, 0);
+    else if(!isset(buf, b % BPB(sb)) && isset(refmap, b))
+      error("block %d in use but marked free", b, 0, 0);
+  }
+
+  for(i = 1; i < sb.ninodes; i++){
+    if(i % BPB(sb) == 0 || i == 1)
+      rblock(IMBLOCK(i, sb), buf);
+    if(isset(buf, i % BPB(sb)) != (type[i] != 0))
+      error("inode %d: type %d but inode map says otherwise", i, type[i], 0);
+    if(type[i] == 0 && nref[i] != 0)
+      error("inode %d: free but named by %d entries", i, nref[i], 0);
+    else if(type[i] != 0 && nref[i] != nlink[i])
+      error("inode %d: nlink %d but %d entries", i, nlink[i], nref[i]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *path;
+  struct statfs st;
+  int i, nworker, fd[2], fds[MAXWORKER], pid, t0;
+  uint lo, hi, per;
+
+  path = "/";
+  nworker = NWORKER;
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-j") == 0 && i+1 < argc)
+      nworker = atoi(argv[++i]);
+    else
+      path = argv[i];
+  }
+  if(nworker < 1 || nworker > MAXWORKER){
+    fprintf(2, "usage: fsck [-j nworker] [path]\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  if(statfs(path, &st) < 0){
+    fprintf(2, "fsck: cannot statfs %s\n", path);
+    exit(1);
+  }
+  dev = st.dev;
+  if(readblock(dev, SBOFF / st.bsize, buf) != st.bsize){
+    fprintf(2, "fsck: %s is not on a disk file system\n", path);
+    exit(1);
+  }
+  memmove(&sb, buf + SBOFF % st.bsize, sizeof(sb));
+  datastart = sb.size - sb.nblocks;
+
+  refmap = malloc(MAPBYTES);
+  nref = malloc(NBYTES);
+  type = malloc(NBYTES);
+  nlink = malloc(NBYTES);
+  memset(refmap, 0, MAPBYTES);
+  memset(nref, 0, NBYTES);
+  memset(type, 0, NBYTES);
+  memset(nlink, 0, NBYTES);
+
+  // Give each worker a run of whole inode blocks.
+  per = (sb.ninodes + nworker - 1) / nworker;
+  per = (per + IPB(sb) - 1) / IPB(sb) * IPB(sb);
+  for(i = 0; i < nworker; i++){
+    lo = i*per > 1 ? i*per : 1;
+    hi = (i+1)*per < sb.ninodes ? (i+1)*per : sb.ninodes;
+    if(pipe(fd) < 0 || (pid = fork()) < 0){
+      fprintf(2, "fsck: cannot start workers\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fd[0]);
+      if(lo < hi)
+        scan(lo, hi);
+      write(fd[1], &nerr, sizeof(nerr));
+      write(fd[1], refmap, MAPBYTES);
+      write(fd[1], nref, NBYTES);
+      write(fd[1], type + lo, (hi > lo ? hi - lo : 0) * sizeof(short));
+      write(fd[1], nlink + lo, (hi > lo ? hi - lo : 0) * sizeof(short));
+      exit(0);
+    }
+    close(fd[1]);
+    fds[i] = fd[0];
+  }
+  for(i = 0; i < nworker; i++){
+    lo = i*per > 1 ? i*per : 1;
+    hi = (i+1)*per < sb.ninodes ? (i+1)*per : sb.ninodes;
+    merge(fds[i], lo, hi > lo ? hi : lo);
+    close(fds[i]);
+    wait(0);
+  }
+  check();
+
+  printf("fsck: dev %d: %d errors, %d ticks\n", dev, nerr, uptime() - t0);
+  printf("fsck: %d/%d blocks free in %d runs (fragmentation %d%%), %d/%d inodes free\n",
+    st.bfree, st.blocks, st.fextents, st.frag, st.ffree, st.files);
+  exit(nerr ? 1 : 0);
+}
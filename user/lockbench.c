@@ -0,0 +1,150 @@
+// Lock contention benchmark.
+//
+// Threads take turns incrementing a shared counter, under a
+// spin lock, a lock made of a pipe holding one token byte, and
+// a futex mutex from ulib, with more and more threads. A spin
+// lock never sleeps, so waiters burn their time slices while
+// the holder is preempted; the pipe lock makes a system call
+// for every acquire and release; the futex mutex makes one
+// only when a thread has to wait.
+//
+//   $ lockbench [rounds]
+//
+// Each thread does rounds lock/unlock pairs; the time per pair
+// is measured with clock_gettime().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/time.h"
+#include "user/user.h"
+
+#define STACK 4096
+#define MAXTHREAD 8
+
+static int nthreads[] = { 1, 2, 4, MAXTHREAD };
+
+int rounds;
+int counter;
+int spin;
+int pipefd[2];
+struct mutex mutex;
+
+static void
+spinlock(void *arg)
+{
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    while(__sync_lock_test_and_set(&spin, 1) != 0)
+      ;
+    counter++;
+    __sync_lock_release(&spin);
+  }
+  exit(0);
+}
+
+static void
+pipelock(void *arg)
+{
+  int i;
+  char c;
+
+  for(i = 0; i < rounds; i++){
+    if(read(pipefd[0], &c, 1) != 1)
+      exit(1);
+    counter++;
+    write(pipefd[1], &c, 1);
+  }
+  exit(0);
+}
+
+static void
+futexlock(void *arg)
+{
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    mutex_lock(&mutex);
+    counter++;
+    mutex_unlock(&mutex);
+  }
+  exit(0);
+}
+
+static uint64
+nsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Run fn in n threads, and return the time they took.
+static uint64
+run(void (*fn)(void*), int n, char *stacks[])
+{
+  int i, xstatus;
+  uint64 ns0;
+
+  counter = 0;
+  ns0 = nsec();
+  for(i = 0; i < n; i++){
+    if(clone(fn, 0, stacks[i] + STACK) < 0){
+      printf("lockbench: clone failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < n; i++){
+    if(join(0, &xstatus) < 0 || xstatus != 0){
+      printf("lockbench: thread failed\n");
+      exit(1);
+    }
+  }
+  if(counter != n * rounds){
+    printf("lockbench: counter %d, not %d\n", counter, n * rounds);
+    exit(1);
+  }
+  return nsec() - ns0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+  uint64 ns;
+  char *stacks[MAXTHREAD];
+  char c = 0;
+
+  rounds = 10000;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0){
+    fprintf(2, "usage: lockbench [rounds]\n");
+    exit(1);
+  }
+  for(i = 0; i < MAXTHREAD; i++){
+    if((stacks[i] = malloc(STACK)) == 0){
+      printf("lockbench: out of memory\n");
+      exit(1);
+    }
+  }
+  if(pipe(pipefd) < 0){
+    printf("lockbench: pipe failed\n");
+    exit(1);
+  }
+  write(pipefd[1], &c, 1);
+  mutex_init(&mutex);
+
+  for(i = 0; i < sizeof(nthreads)/sizeof(nthreads[0]); i++){
+    n = nthreads[i];
+    printf("%d threads:", n);
+    ns = run(spinlock, n, stacks);
+    printf(" spin %d ns,", (int)(ns / (n * rounds)));
+    ns = run(pipelock, n, stacks);
+    printf(" pipe %d ns,", (int)(ns / (n * rounds)));
+    ns = run(futexlock, n, stacks);
+    printf(" futex %d ns per lock\n", (int)(ns / (n * rounds)));
+  }
+  exit(0);
+}
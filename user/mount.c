@@ -0,0 +1,26 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// mount dir dev: mount the file system on device dev on dir.
+// mount -u dir: unmount the file system mounted on dir.
+int
+main(int argc, char *argv[])
+{
+  if(argc == 3 && strcmp(argv[1], "-u") == 0){
+    if(umount(argv[2]) < 0){
+      fprintf(2, "umount %s: failed\n", argv[2]);
+      exit(1);
+    }
+    exit(0);
+  }
+  if(argc != 3){
+    fprintf(2, "Usage: mount dir dev | mount -u dir\n");
+    exit(1);
+  }
+  if(mount(argv[1], atoi(argv[2])) < 0){
+    fprintf(2, "mount %s %s: failed\n", argv[1], argv[2]);
+    exit(1);
+  }
+  exit(0);
+}
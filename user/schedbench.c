@@ -0,0 +1,130 @@
+// Scheduling latency benchmark.
+//
+// Two processes bounce a byte back and forth over a pair of
+// pipes, so every round trip is two wakeups and two trips
+// through the scheduler. The ping-pong is repeated with more
+// and more idle processes sleeping in the background; if the
+// scheduler's cost depends on the size of the process table
+// rather than on the number of runnable processes, the round
+// trip rate falls as the idle count rises.
+//
+//   $ schedbench [ticks]
+//
+// A tick is about 1/10th of a second; the round trip time is
+// measured with clock_gettime().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/time.h"
+#include "user/user.h"
+
+static int idles[] = { 0, 8, 16, 32, NPROC - 8 };
+
+// Fork n processes that block reading fd until it is closed.
+// Returns the number started.
+static int
+startidle(int n, int fd[2])
+{
+  int i, pid;
+  char c;
+
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      close(fd[1]);
+      read(fd[0], &c, 1);
+      exit(0);
+    }
+  }
+  return i;
+}
+
+static uint64
+nsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Count ping-pong round trips completed in nticks,
+// and set *ns to the time they took.
+static int
+pingpong(int nticks, uint64 *ns)
+{
+  int ping[2], pong[2], pid, n, t0;
+  uint64 ns0;
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("schedbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  t0 = uptime();
+  while(uptime() == t0)
+    ;
+  t0 = uptime();
+  ns0 = nsec();
+  for(n = 0; uptime() - t0 < nticks; n++){
+    write(ping[1], &c, 1);
+    if(read(pong[0], &c, 1) != 1){
+      printf("schedbench: short read\n");
+      exit(1);
+    }
+  }
+  *ns = nsec() - ns0;
+  close(ping[1]);
+  close(pong[0]);
+  wait(0);
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, nticks, nidle, n, fd[2];
+  uint64 ns;
+
+  nticks = 10;
+  if(argc > 1)
+    nticks = atoi(argv[1]);
+  if(nticks <= 0){
+    fprintf(2, "usage: schedbench [ticks]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < sizeof(idles)/sizeof(idles[0]); i++){
+    if(pipe(fd) < 0){
+      printf("schedbench: pipe failed\n");
+      exit(1);
+    }
+    nidle = startidle(idles[i], fd);
+    close(fd[0]);
+    n = pingpong(nticks, &ns);
+    printf("%d idle: %d round trips in %d ticks, %d ns each\n",
+           nidle, n, nticks, n ? (int)(ns / n) : 0);
+    close(fd[1]);
+    while(wait(0) >= 0)
+      ;
+  }
+  exit(0);
+}
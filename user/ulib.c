@@ -1,6 +1,11 @@
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/time.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 
 char*
@@ -134,3 +139,110 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// The vDSO page (see kernel/vdso.h): getpid(), uptime() and
+// clock_gettime(CLOCK_MONOTONIC) without a system call. The
+// threads of a process share one page table, and so one vDSO
+// page: vgetpid() in a thread made by clone() gives the pid of
+// the process's first thread, not the thread's own getpid().
+
+static uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+int
+vgetpid(void)
+{
+  return ((struct vdso*)VDSO)->pid;
+}
+
+uint
+vuptime(void)
+{
+  return rdtime() / ((struct vdso*)VDSO)->tickcycles;
+}
+
+int
+vclock_gettime(int clock, struct timespec *ts)
+{
+  struct vdso *v = (struct vdso*)VDSO;
+  uint64 t;
+
+  if(clock != CLOCK_MONOTONIC)
+    return -1;
+  t = rdtime();
+  ts->tv_sec = t / v->mtimehz;
+  ts->tv_nsec = (t % v->mtimehz) * (1000000000 / v->mtimehz);
+  return 0;
+}
+
+// Locks for threads, on futexes. A mutex's state is 0 if it
+// is free, 1 if held, and 2 if held with possible waiters; only
+// an unlock from 2 needs a system call. A condition variable is
+// a count of signals, which cond_wait() sleeps until changes.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2, 0);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Atomically unlock m and wait for c to be signalled, then
+// lock m again. May return without a signal.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = *(volatile int*)&c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq, 0);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, NPROC);
+}
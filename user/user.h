@@ -1,5 +1,8 @@
 struct stat;
+struct statfs;
 struct rtcdate;
+struct iovec;
+struct timespec;
 
 // system calls
 int fork(void);
@@ -23,6 +26,28 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int sendfile(int, int, int);
+int fsync(int);
+int fdatasync(int);
+int mount(const char*, int);
+int umount(const char*);
+int statfs(const char*, struct statfs*);
+int readblock(int, uint, void*);
+int fallocate(int, uint, uint);
+int nice(int);
+int setpriority(int, int);
+int clock_gettime(int, struct timespec*);
+int nanosleep(const struct timespec*, struct timespec*);
+int sched_setaffinity(int, uint);
+int sched_getaffinity(int);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int, const struct timespec*);
+int futex_wake(int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +65,20 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int vgetpid(void);  // the process's pid: its first thread's, in any thread
+uint vuptime(void);
+int vclock_gettime(int, struct timespec*);
+
+struct mutex {
+  int state;
+};
+struct cond {
+  int seq;
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
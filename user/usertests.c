@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uio.h"
+#include "kernel/time.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -523,6 +525,624 @@ writetest(char *s)
   }
 }
 
+// pread/pwrite use an explicit offset and leave the file
+// offset alone; readv/writev move several buffers at once.
+void
+preadwrite(char *s)
+{
+  int fd, i;
+  char a[8], b[8];
+  struct iovec iov[2];
+
+  fd = open("prw", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create prw failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "0123";
+  iov[0].iov_len = 4;
+  iov[1].iov_base = "456789";
+  iov[1].iov_len = 6;
+  if(writev(fd, iov, 2) != 10){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "ab", 2, 3) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, a, 4, 2) != 4 || memcmp(a, "2ab5", 4) != 0){
+    printf("%s: pread got wrong data\n", s);
+    exit(1);
+  }
+  if(pread(fd, a, 4, 20) != 0){
+    printf("%s: pread past end of file\n", s);
+    exit(1);
+  }
+  // the file offset is still at the end of the writev.
+  if(write(fd, "X", 1) != 1 || pread(fd, a, 1, 10) != 1 || a[0] != 'X'){
+    printf("%s: pwrite/pread moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("prw", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = 3;
+  iov[1].iov_base = b;
+  iov[1].iov_len = 8;
+  if((i = readv(fd, iov, 2)) != 11){
+    printf("%s: readv returned %d\n", s, i);
+    exit(1);
+  }
+  if(memcmp(a, "012", 3) != 0 || memcmp(b, "ab56789X", 8) != 0){
+    printf("%s: readv got wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("prw");
+}
+
+// sendfile from a file to another file and to a pipe.
+void
+sendfiletest(char *s)
+{
+  enum { SZ = 3*BSIZE + 100 };
+  int fd, fd1, i, n, fds[2];
+  char c;
+
+  fd = open("sf0", O_CREATE|O_RDWR);
+  for(i = 0; i < SZ; i++){
+    c = 'a' + i % 26;
+    if(write(fd, &c, 1) != 1){
+      printf("%s: write sf0 failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("sf0", O_RDONLY);
+  fd1 = open("sf1", O_CREATE|O_RDWR);
+  if(fd < 0 || fd1 < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if((n = sendfile(fd1, fd, SZ + 10)) != SZ){
+    printf("%s: sendfile to file moved %d\n", s, n);
+    exit(1);
+  }
+  if(sendfile(fd1, fd, 10) != 0){
+    printf("%s: sendfile past end of file\n", s);
+    exit(1);
+  }
+  close(fd1);
+
+  fd1 = open("sf1", O_RDONLY);
+  pipe(fds);
+  if(fork() == 0){
+    close(fds[0]);
+    if(sendfile(fds[1], fd1, SZ) != SZ)
+      exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  for(i = 0; (n = read(fds[0], &c, 1)) == 1; i++){
+    if(c != 'a' + i % 26){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  wait(&n);
+  if(i != SZ || n != 0){
+    printf("%s: sendfile to pipe moved %d\n", s, i);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fd);
+  close(fd1);
+  unlink("sf0");
+  unlink("sf1");
+}
+
+// fsync and fdatasync on files, and on things that aren't.
+void
+fsynctest(char *s)
+{
+  int fd, fds[2];
+  char buf[10];
+
+  fd = open("fsync0", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "0123456789", 10) != 10 || fsync(fd) != 0){
+    printf("%s: fsync after write failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "abcdefghij", 10) != 10 || fdatasync(fd) != 0){
+    printf("%s: fdatasync after write failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf("%s: fsync of clean file failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 10, 10) != 10 || buf[0] != 'a'){
+    printf("%s: wrong data after fsync\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsync0");
+
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+  pipe(fds);
+  if(fsync(fds[0]) != -1){
+    printf("%s: fsync of pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// files, directories and .. in the tmpfs mounted on /tmp.
+void
+tmpfstest(char *s)
+{
+  int fd, i;
+  struct stat st;
+  char b[8];
+
+  if(stat("/tmp", &st) < 0 || st.type != T_DIR || st.dev != TMPDEV){
+    printf("%s: /tmp is not a tmpfs\n", s);
+    exit(1);
+  }
+  if(mkdir("/tmp/tt") != 0){
+    printf("%s: mkdir /tmp/tt failed\n", s);
+    exit(1);
+  }
+  fd = open("/tmp/tt/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create /tmp/tt/f failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*4096 + 100; i += sizeof(b)){
+    memset(b, '0' + (i/4096), sizeof(b));
+    if(write(fd, b, sizeof(b)) != sizeof(b)){
+      printf("%s: write /tmp/tt/f failed\n", s);
+      exit(1);
+    }
+  }
+  if(pread(fd, b, 1, 2*4096 + 7) != 1 || b[0] != '2'){
+    printf("%s: wrong data in /tmp/tt/f\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync /tmp/tt/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(chdir("/tmp/tt") != 0 || stat("../../README", &st) != 0 ||
+     st.dev != ROOTDEV || stat("f", &st) != 0 || st.dev != TMPDEV){
+    printf("%s: .. across the mount point failed\n", s);
+    exit(1);
+  }
+  if(chdir("/") != 0){
+    printf("%s: chdir / failed\n", s);
+    exit(1);
+  }
+  if(link("/tmp/tt/f", "tmpfslink") == 0){
+    printf("%s: link across file systems succeeded\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp") == 0){
+    printf("%s: unlinked mount point\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/tt") == 0){
+    printf("%s: unlinked non-empty directory\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/tt/f") != 0 || unlink("/tmp/tt") != 0){
+    printf("%s: unlink in /tmp failed\n", s);
+    exit(1);
+  }
+  if(open("/tmp/tt/f", O_RDONLY) >= 0){
+    printf("%s: /tmp/tt/f still there\n", s);
+    exit(1);
+  }
+}
+
+// a write to /tmp from an unmapped buffer fails, rather
+// than coming up short.
+void
+tmpfsbadwrite(char *s)
+{
+  int fd, n;
+
+  fd = open("/tmp/badwrite", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create /tmp/badwrite failed\n", s);
+    exit(1);
+  }
+  n = write(fd, (char*)0xdeadbeefLL, 8192);
+  if(n != -1){
+    printf("%s: write from bad pointer returned %d, not -1\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  unlink("/tmp/badwrite");
+}
+
+// unmount and remount the tmpfs on /tmp.
+void
+mounttest(char *s)
+{
+  int fd;
+  struct stat st;
+
+  fd = open("/tmp/mt", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf("%s: create /tmp/mt failed\n", s);
+    exit(1);
+  }
+  if(umount("/tmp") == 0){
+    printf("%s: unmounted busy file system\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(umount("/") == 0 || umount("/README") == 0){
+    printf("%s: unmounted something not mounted\n", s);
+    exit(1);
+  }
+  if(umount("/tmp") != 0){
+    printf("%s: umount /tmp failed\n", s);
+    exit(1);
+  }
+  if(stat("/tmp", &st) != 0 || st.dev != ROOTDEV || stat("/tmp/mt", &st) == 0){
+    printf("%s: /tmp still mounted\n", s);
+    exit(1);
+  }
+  if(mount("/README", TMPDEV) == 0 || mount("/", TMPDEV) == 0 ||
+     mount("/tmp", ROOTDEV) == 0 || mount("/tmp", NDEV+1) == 0){
+    printf("%s: bad mount succeeded\n", s);
+    exit(1);
+  }
+  if(mount("/tmp", TMPDEV) != 0){
+    printf("%s: remount /tmp failed\n", s);
+    exit(1);
+  }
+  if(mount("/tmp", TMPDEV) == 0){
+    printf("%s: mounted twice\n", s);
+    exit(1);
+  }
+  if(stat("/tmp/mt", &st) != 0 || st.size != 1 || st.dev != TMPDEV){
+    printf("%s: /tmp/mt lost across umount\n", s);
+    exit(1);
+  }
+  unlink("/tmp/mt");
+}
+
+// Wait for the kernel to finish freeing the blocks of big
+// deleted files, so that free block counts hold still.
+void
+settle(void)
+{
+  struct statfs st0, st;
+  int fd;
+
+  fd = open("settle", O_CREATE|O_RDWR);
+  do {
+    statfs(".", &st0);
+    pwrite(fd, "x", 1, 0);  // each write frees a batch
+    sleep(1);  // or lets the flusher free one
+    statfs(".", &st);
+  } while(st.bfree != st0.bfree);
+  close(fd);
+  unlink("settle");
+}
+
+// statfs() must see blocks and inodes come and go, and
+// readblock() must read the super block.
+void
+statfstest(char *s)
+{
+  struct statfs st0, st1, st;
+  struct superblock *sbp;
+  int fd, i;
+
+  settle();
+  if(statfs("/", &st0) != 0 || st0.dev != ROOTDEV || st0.bsize < BSIZE ||
+     st0.bfree > st0.blocks || st0.ffree > st0.files || st0.frag > 100){
+    printf("%s: bad statfs /\n", s);
+    exit(1);
+  }
+  fd = open("statfs0", O_CREATE|O_RDWR);
+  for(i = 0; i < 3; i++){
+    if(write(fd, buf, st0.bsize) != st0.bsize){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  statfs("/", &st1);
+  if(st1.bfree > st0.bfree - 3 || st1.ffree != st0.ffree - 1){
+    printf("%s: statfs did not see new file\n", s);
+    exit(1);
+  }
+  unlink("statfs0");
+  statfs("/", &st);
+  if(st.bfree != st0.bfree || st.ffree != st0.ffree){
+    printf("%s: statfs did not see unlink\n", s);
+    exit(1);
+  }
+
+  if(statfs("/tmp", &st) != 0 || st.dev != TMPDEV || statfs("/nonexistent", &st) == 0){
+    printf("%s: bad statfs /tmp\n", s);
+    exit(1);
+  }
+  if(readblock(TMPDEV, 0, buf) >= 0 || readblock(ROOTDEV, st0.blocks + 1000000, buf) >= 0){
+    printf("%s: bad readblock succeeded\n", s);
+    exit(1);
+  }
+  if(readblock(ROOTDEV, SBOFF / st0.bsize, buf) != st0.bsize){
+    printf("%s: readblock failed\n", s);
+    exit(1);
+  }
+  sbp = (struct superblock*)(buf + SBOFF % st0.bsize);
+  if(sbp->magic != FSMAGIC || sbp->bsize != st0.bsize || sbp->nblocks != st0.blocks){
+    printf("%s: readblock read a bad super block\n", s);
+    exit(1);
+  }
+}
+
+// A small file's data lives in its inode, and moves to a
+// block when the file grows.
+void
+inlinetest(char *s)
+{
+  struct statfs st0, st;
+  char data[100], got[100];
+  int fd, i;
+
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = 'a' + i % 26;
+  settle();
+  statfs(".", &st0);
+  fd = open("inline", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, 10) != 10 || write(fd, data + 10, 20) != 20){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  statfs(".", &st);
+  if(st.bfree != st0.bfree){
+    printf("%s: small file used a block\n", s);
+    exit(1);
+  }
+  if(pread(fd, got, sizeof(got), 0) != 30 || memcmp(got, data, 30) != 0){
+    printf("%s: wrong inline data\n", s);
+    exit(1);
+  }
+  if(write(fd, data + 30, 70) != 70){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  statfs(".", &st);
+  if(st.bfree != st0.bfree - 1){
+    printf("%s: grown file has no block\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inline", O_RDONLY);
+  if(read(fd, got, sizeof(got)) != 100 || memcmp(got, data, 100) != 0){
+    printf("%s: wrong data after growing\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inline", O_RDWR|O_TRUNC);
+  write(fd, "x", 1);
+  close(fd);
+  statfs(".", &st);
+  if(st.bfree != st0.bfree){
+    printf("%s: truncate did not free the block\n", s);
+    exit(1);
+  }
+  unlink("inline");
+}
+
+// Blocks of a big deleted file are freed in the background,
+// a batch at a time; those of a truncated one at once.
+void
+reclaimtest(char *s)
+{
+  struct statfs st0, st;
+  int fd, i, nb;
+
+  settle();
+  statfs(".", &st0);
+  nb = 2*NDIRECT;  // needs an indirect block
+  for(int pass = 0; pass < 2; pass++){
+    fd = open("reclaim", O_CREATE|O_RDWR);
+    for(i = 0; i < nb; i++){
+      if(write(fd, buf, st0.bsize) != st0.bsize){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    close(fd);
+    statfs(".", &st);
+    if(st.bfree != st0.bfree - nb - 1){
+      printf("%s: %d blocks used, expected %d\n", s, st0.bfree - st.bfree, nb + 1);
+      exit(1);
+    }
+    if(pass == 0){
+      fd = open("reclaim", O_RDWR|O_TRUNC);
+      close(fd);
+    } else {
+      unlink("reclaim");
+      // the flusher frees the blocks; give it ten seconds.
+      for(i = 0; i < 100; i++){
+        statfs(".", &st);
+        if(st.bfree == st0.bfree)
+          break;
+        sleep(1);
+      }
+    }
+    statfs(".", &st);
+    if(st.bfree != st0.bfree){
+      printf("%s: pass %d: %d blocks not freed\n", s, pass, st0.bfree - st.bfree);
+      exit(1);
+    }
+  }
+  unlink("reclaim");
+}
+
+// O_DIRECT reads and writes must see the same data as
+// cached ones, aligned or not.
+void
+directtest(char *s)
+{
+  struct statfs st;
+  char *p;
+  int fd, i, n, bs;
+
+  statfs(".", &st);
+  bs = st.bsize;
+  n = 2*bs;
+  p = sbrk(n + PGSIZE);
+  p = (char*)PGROUNDUP((uint64)p);  // whole blocks within pages
+
+  fd = open("direct", O_CREATE|O_RDWR);
+  for(i = 0; i < n; i++)
+    p[i] = i % 251;
+  if(write(fd, p, n) != n){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("direct", O_RDWR|O_DIRECT);
+  memset(p, 0, n);
+  if(read(fd, p, n) != n || read(fd, p, 1) != 0){
+    printf("%s: direct read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != (char)(i % 251)){
+      printf("%s: direct read wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  // unaligned, and into a buffer that isn't page aligned.
+  if(pread(fd, buf, bs, 10) != bs || memcmp(buf, p + 10, bs) != 0){
+    printf("%s: unaligned direct read failed\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < n; i++)
+    p[i] = 'a' + i % 26;
+  if(pwrite(fd, p, n, 0) != n || pwrite(fd, p, 5, n) != 5){
+    printf("%s: direct write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("direct", O_RDONLY);
+  if(read(fd, buf, n + 10) != n + 5 || memcmp(buf, p, n) != 0 ||
+     memcmp(buf + n, p, 5) != 0){
+    printf("%s: wrong data after direct write\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("direct");
+}
+
+// an O_DIRECT write from an unmapped buffer fails, over
+// blocks the file has and blocks it doesn't.
+void
+directbadwrite(char *s)
+{
+  int fd, n;
+
+  fd = open("directbad", O_CREATE|O_RDWR);
+  memset(buf, 'x', 4096);
+  if(write(fd, buf, 4096) != 4096){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("directbad", O_RDWR|O_DIRECT);
+  n = write(fd, (char*)0xdeadbeefLL, 8192);
+  if(n != -1){
+    printf("%s: direct write from bad pointer returned %d, not -1\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  unlink("directbad");
+}
+
+// fallocate() must allocate blocks up front, so that writing
+// them takes no more.
+void
+fallocatetest(char *s)
+{
+  struct statfs st0, st1, st;
+  struct stat sb;
+  int fd, i, n, bs;
+
+  settle();
+  statfs(".", &st0);
+  bs = st0.bsize;
+  n = NDIRECT + 4;  // and an indirect block
+  fd = open("falloc", O_CREATE|O_RDWR);
+  if(fallocate(fd, 0, n*bs) != 0){
+    printf("%s: fallocate failed\n", s);
+    exit(1);
+  }
+  statfs(".", &st1);
+  if(fstat(fd, &sb) != 0 || sb.size != 0 || st1.bfree != st0.bfree - n - 1){
+    printf("%s: fallocate used %d blocks, size %d\n", s, st0.bfree - st1.bfree, (int)sb.size);
+    exit(1);
+  }
+  if(fallocate(fd, 0, bs) != 0 || fallocate(fd, 0, 0) == 0 ||
+     fallocate(fd, 0, 0x7fffffff) == 0){
+    printf("%s: bad fallocate\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    memset(buf, 'a' + i, bs);
+    if(write(fd, buf, bs) != bs){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  statfs(".", &st);
+  if(st.bfree != st1.bfree){
+    printf("%s: writes allocated %d more blocks\n", s, st1.bfree - st.bfree);
+    exit(1);
+  }
+  pread(fd, buf, bs, (n-1)*bs);
+  if(buf[0] != 'a' + n - 1 || buf[bs-1] != 'a' + n - 1){
+    printf("%s: wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("falloc");
+
+  fd = open("/tmp/falloc", O_CREATE|O_RDWR);
+  if(fallocate(fd, 0, bs) == 0){
+    printf("%s: fallocate on tmpfs succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("/tmp/falloc");
+}
+
 void
 writebig(char *s)
 {
@@ -791,6 +1411,409 @@ preempt(char *s)
   wait(0);
 }
 
+// nice levels are clamped, and a process at the lowest
+// priority still gets to run next to CPU-bound ones.
+void
+nicetest(char *s)
+{
+  int i, pid, pids[2];
+  int pfds[2];
+
+  if(nice(0) != 0 || nice(1) != 1 || nice(100) != NPRIO-1 || nice(-100) != 0){
+    printf("%s: nice levels not clamped\n", s);
+    exit(1);
+  }
+  if(setpriority(getpid(), 1) != 0 || nice(0) != 1 ||
+     setpriority(getpid(), 0) != 0 || setpriority(-1, 0) != -1){
+    printf("%s: bad setpriority\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < 2; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pids[i] == 0)
+      for(;;)
+        ;
+  }
+  pipe(pfds);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(pfds[0]);
+    nice(NPRIO-1);
+    for(i = 0; i < 1000000; i++)
+      ;
+    write(pfds[1], "x", 1);
+    exit(0);
+  }
+  close(pfds[1]);
+  if(read(pfds[0], buf, 1) != 1){
+    printf("%s: niced child did not run\n", s);
+    exit(1);
+  }
+  close(pfds[0]);
+  kill(pids[0]);
+  kill(pids[1]);
+  wait(0);
+  wait(0);
+  wait(0);
+}
+
+// sleepers with different timeouts, some far enough off to
+// be cascaded down the timer wheel, wake in deadline order
+// and not before their time.
+void
+sleeptimer(char *s)
+{
+  int i, pid, t0, fds[2];
+  char c, last;
+
+  pipe(fds);
+  for(i = 7; i >= 0; i--){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      t0 = uptime();
+      sleep(i*10);
+      if(uptime() - t0 < i*10){
+        printf("%s: sleep(%d) woke early\n", s, i*10);
+        exit(1);
+      }
+      c = i;
+      write(fds[1], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  last = 0;
+  for(i = 0; i < 8; i++){
+    if(read(fds[0], &c, 1) != 1 || c < last){
+      printf("%s: sleepers woke out of order\n", s);
+      exit(1);
+    }
+    last = c;
+  }
+  close(fds[0]);
+  for(i = 0; i < 8; i++){
+    wait(&pid);
+    if(pid != 0)
+      exit(1);
+  }
+}
+
+static uint64
+nsec(void)
+{
+  struct timespec ts;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the monotonic clock runs forward, and nanosleep() sleeps
+// at least as long as asked, and not a whole tick for less.
+void
+nanosleeptest(char *s)
+{
+  struct timespec ts;
+  uint64 t0, t1;
+  int i;
+
+  if(clock_gettime(0, &ts) != -1 || clock_gettime(CLOCK_MONOTONIC, (void*)0xeaeb0b5b00002f5e) != -1){
+    printf("%s: bad clock_gettime succeeded\n", s);
+    exit(1);
+  }
+  ts.tv_sec = 0;
+  ts.tv_nsec = 1000000000;
+  if(nanosleep(&ts, 0) != -1){
+    printf("%s: nanosleep took tv_nsec >= 1s\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < 10; i++){
+    ts.tv_sec = 0;
+    ts.tv_nsec = 2000000 * (i+1);  // 2ms to 20ms
+    t0 = nsec();
+    if(nanosleep(&ts, 0) != 0){
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+    t1 = nsec();
+    if(t1 < t0 + ts.tv_nsec){
+      printf("%s: nanosleep(%d ns) took %d ns\n", s, (int)ts.tv_nsec, (int)(t1 - t0));
+      exit(1);
+    }
+    if(t1 - t0 > ts.tv_nsec + 100000000){
+      printf("%s: nanosleep(%d ns) took a tick too long, %d ns\n", s, (int)ts.tv_nsec, (int)(t1 - t0));
+      exit(1);
+    }
+  }
+
+  ts.tv_sec = 0;
+  ts.tv_nsec = 250000000;  // past a few tick boundaries
+  t0 = nsec();
+  nanosleep(&ts, 0);
+  if(nsec() - t0 < ts.tv_nsec){
+    printf("%s: nanosleep woke early\n", s);
+    exit(1);
+  }
+}
+
+// the vDSO page gives the same answers as the system calls,
+// in every process, and user code can't write it.
+void
+vdsotest(char *s)
+{
+  struct timespec ts;
+  uint64 t0, t1;
+  int pid, xstatus;
+
+  t0 = nsec();
+  if(vclock_gettime(CLOCK_MONOTONIC, &ts) != 0){
+    printf("%s: vclock_gettime failed\n", s);
+    exit(1);
+  }
+  t1 = ts.tv_sec * 1000000000 + ts.tv_nsec;
+  if(t1 < t0 || t1 > nsec()){
+    printf("%s: vdso clock disagrees with clock_gettime\n", s);
+    exit(1);
+  }
+  xstatus = (int)vuptime() - uptime();
+  if(xstatus < -1 || xstatus > 1){
+    printf("%s: vuptime %d, uptime %d\n", s, vuptime(), uptime());
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(vgetpid() != getpid())
+      exit(1);
+    *(int*)VDSO = 0;
+    exit(2);  // the write should have killed us
+  }
+  wait(&xstatus);
+  if(xstatus != -1 || vgetpid() != getpid()){
+    printf("%s: vdso pid wrong, or writable\n", s);
+    exit(1);
+  }
+}
+
+// affinity masks are checked, inherited by fork(), and
+// processes pinned to one CPU all get to run there.
+void
+affinitytest(char *s)
+{
+  int all, i, pid, xstatus;
+
+  all = sched_getaffinity(0);
+  if(all <= 0 || sched_getaffinity(getpid()) != all || sched_getaffinity(-1) != -1){
+    printf("%s: bad sched_getaffinity\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 0) != -1 || sched_setaffinity(-1, all) != -1){
+    printf("%s: bad sched_setaffinity succeeded\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 1) != 0 || sched_getaffinity(0) != 1){
+    printf("%s: sched_setaffinity failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(sched_getaffinity(0) != 1)
+        exit(1);
+      for(xstatus = 0; xstatus < 1000000; xstatus++)
+        ;
+      exit(0);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child lost its affinity\n", s);
+      exit(1);
+    }
+  }
+  sched_setaffinity(0, all);
+}
+
+#define NCLONE 4
+
+int clonecount;
+
+void
+clonecounter(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 10000; i++)
+    __sync_fetch_and_add(&clonecount, 1);
+  exit((uint64)arg);
+}
+
+void
+clonespin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// threads share memory and are joined, not waited for, and
+// the first thread's exit takes the others with it.
+void
+clonetest(char *s)
+{
+  int i, tid[NCLONE], pid, xstatus;
+  char *stack;
+
+  clonecount = 0;
+  for(i = 0; i < NCLONE; i++){
+    stack = malloc(4096);
+    tid[i] = clone(clonecounter, (void*)(uint64)i, stack + 4096);
+    if(tid[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  if(wait(0) != -1){
+    printf("%s: wait returned a thread\n", s);
+    exit(1);
+  }
+  for(i = NCLONE-1; i >= 0; i--){
+    if(join(tid[i], &xstatus) != tid[i] || xstatus != i){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+  }
+  if(join(0, 0) != -1 || clonecount != NCLONE*10000){
+    printf("%s: threads lost, or count %d wrong\n", s, clonecount);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    stack = malloc(4096);
+    if(clone(clonespin, 0, stack + 4096) < 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: clone in child failed\n", s);
+    exit(1);
+  }
+}
+
+struct mutex futexmutex;
+struct cond futexcond;
+int futexflag;
+
+void
+futexcounter(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&futexmutex);
+    clonecount++;
+    mutex_unlock(&futexmutex);
+  }
+  exit(0);
+}
+
+void
+futexwaiter(void *arg)
+{
+  mutex_lock(&futexmutex);
+  while(futexflag == 0)
+    cond_wait(&futexcond, &futexmutex);
+  mutex_unlock(&futexmutex);
+  exit(0);
+}
+
+// futex_wait() checks the value and times out, and the
+// mutex and condition variable built on futexes work.
+void
+futextest(char *s)
+{
+  int i, tid, x = 0;
+  struct timespec ts;
+  uint64 t0;
+
+  if(futex_wait(&x, 1, 0) != -1 || futex_wait((int*)((char*)&x + 1), 0, 0) != -1){
+    printf("%s: futex_wait didn't fail\n", s);
+    exit(1);
+  }
+  if(futex_wake(&x, 1) != 0){
+    printf("%s: futex_wake woke someone\n", s);
+    exit(1);
+  }
+  ts.tv_sec = 0;
+  ts.tv_nsec = 50000000;
+  t0 = nsec();
+  if(futex_wait(&x, 0, &ts) != 1 || nsec() - t0 < 50000000){
+    printf("%s: futex_wait didn't time out\n", s);
+    exit(1);
+  }
+
+  clonecount = 0;
+  mutex_init(&futexmutex);
+  for(i = 0; i < NCLONE; i++){
+    if(clone(futexcounter, 0, malloc(4096) + 4096) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  while(join(0, 0) > 0)
+    ;
+  if(clonecount != NCLONE*1000){
+    printf("%s: mutex lost counts, %d\n", s, clonecount);
+    exit(1);
+  }
+
+  cond_init(&futexcond);
+  futexflag = 0;
+  tid = clone(futexwaiter, 0, malloc(4096) + 4096);
+  if(tid < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  sleep(1);
+  mutex_lock(&futexmutex);
+  futexflag = 1;
+  cond_signal(&futexcond);
+  mutex_unlock(&futexmutex);
+  if(join(tid, 0) != tid){
+    printf("%s: cond waiter lost\n", s);
+    exit(1);
+  }
+}
+
 // try to find any races between exit and wait
 void
 exitwait(char *s)
@@ -2678,6 +3701,18 @@ main(int argc, char *argv[])
     {stacktest, "stacktest"},
     {opentest, "opentest"},
     {writetest, "writetest"},
+    {preadwrite, "preadwrite"},
+    {sendfiletest, "sendfile"},
+    {fsynctest, "fsync"},
+    {tmpfstest, "tmpfs"},
+    {tmpfsbadwrite, "tmpfsbadwrite"},
+    {mounttest, "mount"},
+    {statfstest, "statfs"},
+    {inlinetest, "inline"},
+    {reclaimtest, "reclaim"},
+    {directtest, "direct"},
+    {directbadwrite, "directbadwrite"},
+    {fallocatetest, "fallocate"},
     {writebig, "writebig"},
     {createtest, "createtest"},
     {openiputtest, "openiput"},
@@ -2686,6 +3721,13 @@ main(int argc, char *argv[])
     {mem, "mem"},
     {pipe1, "pipe1"},
     {preempt, "preempt"},
+    {nicetest, "nice"},
+    {sleeptimer, "sleeptimer"},
+    {nanosleeptest, "nanosleep"},
+    {vdsotest, "vdso"},
+    {affinitytest, "affinity"},
+    {clonetest, "clone"},
+    {futextest, "futex"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
     {fourteen, "fourteen"},
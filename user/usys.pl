@@ -36,3 +36,25 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("sendfile");
+entry("fsync");
+entry("fdatasync");
+entry("mount");
+entry("umount");
+entry("statfs");
+entry("readblock");
+entry("fallocate");
+entry("nice");
+entry("setpriority");
+entry("clock_gettime");
+entry("nanosleep");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");